@@ -0,0 +1,168 @@
+#ifndef BALANCED_WAVELET_BUILDER_H
+#define BALANCED_WAVELET_BUILDER_H
+// External memory construction of BalancedWavelet, for sequences larger
+// than memory.
+
+#include "balanced-wavelet.h"
+#include "fast-bit-vector.h"
+#include <stdint.h>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// Builds BalancedWavelet<> over the native endian IntType values in the
+// file input_path. Writes it to output_path in the format of
+// BalancedWavelet::save, readable with BalancedWavelet<FastBitVectorView>.
+//
+// Every level is one sequential pass: values are read from the previous
+// level's temporary file, their bits appended to a temporary bit file, and
+// the level's stable partition written to a new temporary file. Within a
+// block, values with bit 0 are written through and values with bit 1 are
+// buffered, spilling to another temporary file when the buffer is full.
+// Buffers take about memory_limit bytes. Temporary files come from
+// tmpfile(). Returns false on I/O error.
+class BalancedWaveletFileBuilder {
+ public:
+  explicit BalancedWaveletFileBuilder(size_t memory_limit)
+      : memory_limit_(memory_limit) { }
+
+  template<typename IntType>
+  bool build(const char* input_path, const char* output_path) const {
+    FILE* in = fopen(input_path, "rb");
+    if (in == nullptr) return false;
+    const size_t chunk = std::max<size_t>(
+        1, memory_limit_ / 4 / sizeof(IntType));
+    std::vector<IntType> buf(chunk);
+
+    // Find the size and the largest value.
+    size_t size = 0;
+    IntType max = 0;
+    for (size_t n; (n = fread(&buf[0], sizeof(IntType), chunk, in)) > 0;) {
+      max = std::max(max, *std::max_element(&buf[0], &buf[n]));
+      size += n;
+    }
+    if (ferror(in)) {
+      fclose(in);
+      return false;
+    }
+    int bits = max == 0 ? 1 : 1 + log2(max);
+    if (bits <= 0) bits = 1;
+
+    std::vector<IntType> zeros(chunk), ones(chunk);
+    std::vector<unsigned long> words(
+        std::max<size_t>(1, chunk * sizeof(IntType) / sizeof(long)));
+    size_t zero_count = 0, one_count = 0, word_count = 0;
+    unsigned long word = 0;
+    size_t spilled = 0;
+    FILE* bit_file = tmpfile();
+    FILE* spill = tmpfile();
+    FILE* cur = in;
+    bool ok = bit_file != nullptr && spill != nullptr;
+
+    auto put_word = [&](unsigned long w) {
+      words[word_count++] = w;
+      if (word_count == words.size()) {
+        ok = ok && fwrite(&words[0], sizeof(long), word_count, bit_file) ==
+                   word_count;
+        word_count = 0;
+      }
+    };
+    auto flush = [&](std::vector<IntType>& vals, size_t* count, FILE* f) {
+      ok = ok && fwrite(&vals[0], sizeof(IntType), *count, f) == *count;
+      *count = 0;
+    };
+
+    size_t g = 0;
+    for (int b = 0; b < bits && ok; ++b) {
+      const int shift = bits - b - 1;
+      FILE* next = shift > 0 ? tmpfile() : nullptr;
+      ok = ok && (shift == 0 || next != nullptr);
+      if (!ok) {
+        if (next != nullptr) fclose(next);
+        break;
+      }
+      // Writes the buffered and spilled ones of the current block to next.
+      auto end_block = [&]() {
+        flush(zeros, &zero_count, next);
+        // Most blocks of the deep levels never spill, skip the seeks.
+        if (spilled > 0) {
+          rewind(spill);
+          for (size_t done = 0; done < spilled && ok;) {
+            size_t n = std::min(chunk, spilled - done);
+            ok = fread(&zeros[0], sizeof(IntType), n, spill) == n &&
+                 fwrite(&zeros[0], sizeof(IntType), n, next) == n;
+            done += n;
+          }
+          rewind(spill);
+          spilled = 0;
+        }
+        flush(ones, &one_count, next);
+      };
+      rewind(cur);
+      uint64_t block = 0;
+      size_t read = 0;
+      for (size_t n;
+           ok && (n = fread(&buf[0], sizeof(IntType), chunk, cur)) > 0;) {
+        read += n;
+        for (size_t i = 0; i < n && ok; ++i, ++g) {
+          const uint64_t x = buf[i];
+          const bool bit = (x >> shift) & 1;
+          word |= uint64_t(bit) << (g % 64);
+          if (g % 64 == 63) {
+            put_word(word);
+            word = 0;
+          }
+          if (shift == 0) continue;
+          const uint64_t key = shift + 1 >= 64 ? 0 : x >> (shift + 1);
+          if (key != block) {
+            end_block();
+            block = key;
+          }
+          if (!bit) {
+            zeros[zero_count++] = buf[i];
+            if (zero_count == chunk) flush(zeros, &zero_count, next);
+          } else {
+            ones[one_count++] = buf[i];
+            if (one_count == chunk) {
+              flush(ones, &one_count, spill);
+              spilled += chunk;
+            }
+          }
+        }
+      }
+      // A short read is either an error or a truncated file.
+      if (ferror(cur) || read != size) ok = false;
+      if (shift != 0 && ok) end_block();
+      if (cur != in) fclose(cur);
+      cur = next;
+    }
+    if (cur != nullptr && cur != in) fclose(cur);
+    fclose(in);
+    // Last, possibly empty, word: the bitvector holds 1 + bits / 64 words.
+    put_word(word);
+    ok = ok && fwrite(&words[0], sizeof(long), word_count, bit_file) ==
+               word_count;
+    if (spill != nullptr) fclose(spill);
+    buf = std::vector<IntType>();
+    zeros = std::vector<IntType>();
+    ones = std::vector<IntType>();
+    words = std::vector<unsigned long>();
+
+    BalancedWaveletFileHeader h = {
+      BalancedWaveletFileHeader::Magic, size, uint64_t(bits)
+    };
+    if (ok) {
+      rewind(bit_file);
+      ok = FastBitVector::SaveFromFile(bit_file, size * bits, output_path,
+                                       &h, sizeof(h), memory_limit_);
+    }
+    if (bit_file != nullptr) fclose(bit_file);
+    return ok;
+  }
+
+ private:
+  size_t memory_limit_;
+};
+
+#endif
@@ -7,6 +7,13 @@
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
 
 template<typename BitVector = FastBitVector>
 class BalancedWavelet;
@@ -66,6 +73,16 @@ class BalancedWaveletEncoder {
   ConstructNode croot;
 };
 
+// Header of files written by BalancedWavelet::save. The bitvector file of
+// the tree follows at offset 64.
+struct BalancedWaveletFileHeader {
+  static const uint64_t Magic = 0x31747661776c6162ull;  // "balwavt1"
+  static const size_t TreeOffset = 64;
+  uint64_t magic;
+  uint64_t size;
+  uint64_t bits;
+};
+
 template<typename BitVector>
 class BalancedWavelet {
  public:
@@ -99,38 +116,70 @@ class BalancedWavelet {
   BalancedWavelet(std::vector<IntType> && vec)
       : BalancedWavelet(&vec[0], vec.size()) { }
 
+  // Reorders vec.
+  template<typename IntType>
+  BalancedWavelet(IntType* vec, size_t size)
+      : BalancedWavelet(vec, size, std::thread::hardware_concurrency()) { }
+
+  // Builds with up to threads threads. The result does not depend on the
+  // number of threads.
+  template<typename IntType>
+  BalancedWavelet(IntType* vec, size_t size, unsigned threads)
+      : BalancedWavelet(vec, size, threads, size) { }
+
+  // Builds using at most max_scratch values of temporary memory besides
+  // vec and the bitvector. With max_scratch < size levels are partitioned
+  // in place on one thread, in O(log(size / max_scratch)) passes per level,
+  // and peak memory is close to vec plus the finished tree.
   template<typename IntType>
-  BalancedWavelet(IntType* vec, size_t size) 
+  BalancedWavelet(IntType* vec, size_t size, unsigned threads,
+                  size_t max_scratch)
       : size_(size) {
     if (size == 0) return;
     IntType max = *std::max_element(&vec[0], &vec[size]);
     bits_ = 1 + log2(max);
     if (bits_ <= 0) bits_ = 1;
-    std::vector<bool> init;
-    init.reserve(bits_ * size_);
-    uint64_t mask = 0ull;
-
+    threads = std::max<size_t>(1, std::min<size_t>(threads,
+                                                   size_ / MinThreadItems));
+    const size_t total = bits_ * size_;
+    std::unique_ptr<unsigned long[]> words(new unsigned long[1 + total / 64]);
+    memset(words.get(), 0, (1 + total / 64) * sizeof(long));
+    const bool in_place = max_scratch < size_;
+    std::vector<IntType> scratch(bits_ > 1 ? std::min(size_, max_scratch) : 0);
+    IntType* cur = vec;
+    IntType* next = scratch.data();
+    // Chunk t is [start[t], start[t + 1]), zeros[t] counts the zero bits
+    // before it.
+    std::vector<size_t> start(threads + 1), zeros(threads + 1);
     for (int b = 0; b < bits_; ++b) {
-      uint64_t bit = 1ull << (bits_ - b - 1);
-      for (size_t i = 0; i < size_; ++i) {
-        init.push_back((vec[i] & bit) != 0);
+      const int shift = bits_ - b - 1;
+      const size_t level = b * size_;
+      // Chunks start at word boundaries of the level so that threads never
+      // write the same word.
+      for (unsigned t = 0; t <= threads; ++t) {
+        size_t g = (level + size_ * t / threads + 63) & ~size_t(63);
+        start[t] = std::min(g, level + size_) - level;
       }
-      size_t start = 0;
-      auto part_pred = [&](IntType x) -> bool {
-        return (x & bit) == 0;
-      };
-      if (bit == 1) break;
-      // sort each block
-      for (size_t i = 0; i <= size_; ++i) {
-        if (i == size_ || (vec[i] & mask) != (vec[start] & mask)) {
-          std::stable_partition(&vec[start], &vec[i], part_pred);
-          start = i;
-        }
+      start[0] = 0;
+      ParallelFor(threads, [&](unsigned t) {
+        zeros[t + 1] = EmitLevel(cur, start[t], start[t + 1], shift,
+                                 level, words.get());
+      });
+      if (shift == 0) break;
+      if (in_place) {
+        PartitionLevel(cur, size_, shift, scratch.data(), scratch.size());
+        continue;
       }
-      mask |= bit;
+      zeros[0] = 0;
+      for (unsigned t = 0; t < threads; ++t) {
+        zeros[t + 1] += zeros[t];
+      }
+      ParallelFor(threads, [&](unsigned t) {
+        PartitionChunk(cur, next, size_, shift, start, zeros, t);
+      });
+      std::swap(cur, next);
     }
-    BitVector tree(init);
-    swap(tree_, tree);
+    tree_ = BitVectorFromWords<BitVector>(std::move(words), total);
   }
   
 #define VEC_INIT
@@ -164,10 +213,12 @@ class BalancedWavelet {
     bits_ = 0;
   }
   BalancedWavelet(BalancedWavelet&& o) 
-      : tree_(std::move(o.tree_)), size_(o.size_), bits_(o.bits_) { }
+      : tree_(std::move(o.tree_)), bounds_(std::move(o.bounds_)),
+        size_(o.size_), bits_(o.bits_) { }
 
   const BalancedWavelet& operator=(BalancedWavelet&& o) {
     tree_ = std::move(o.tree_);
+    bounds_ = std::move(o.bounds_);
     size_ = o.size_;
     bits_ = o.bits_;
     o.size_ = 0;
@@ -175,6 +226,12 @@ class BalancedWavelet {
     return *this;
   }
 
+  // Offset and rank of a node, for cacheNodes.
+  struct NodeBound {
+    size_t offset;
+    size_t rank;
+  };
+
   class Iterator {
    public:
     Iterator(const BalancedWavelet& wt)
@@ -183,9 +240,13 @@ class BalancedWavelet {
           offset(0),
           bit(wt.bits_ - 1),
           begin_rank(0),
-          end_rank(wt.tree_.rank(wt.size_, 1)),
+          end_rank(wt.bounds_.empty() ? wt.tree_.rank(wt.size_, 1)
+                                      : wt.bounds_[2].rank),
           level_skip(wt.size_),
-          vec(&wt.tree_)
+          vec(&wt.tree_),
+          node(1),
+          bounds(wt.bounds_.empty() ? nullptr : &wt.bounds_[0]),
+          cached_nodes(wt.bounds_.size() - 1)
     {}
     // Null constructor - only operator= is supported.
     Iterator() 
@@ -196,7 +257,10 @@ class BalancedWavelet {
           begin_rank(0),
           end_rank(0),
           level_skip(0),
-          vec(nullptr)
+          vec(nullptr),
+          node(0),
+          bounds(nullptr),
+          cached_nodes(0)
     {}
 
     const Iterator& operator=(const Iterator& o) {
@@ -208,6 +272,9 @@ class BalancedWavelet {
       end_rank = o.end_rank;
       level_skip = o.level_skip;
       vec = o.vec;
+      node = o.node;
+      bounds = o.bounds;
+      cached_nodes = o.cached_nodes;
       return *this;
     }
 
@@ -232,6 +299,13 @@ class BalancedWavelet {
       size_t orank = bit ? begin_rank : offset - begin_rank;
       return vec->rank(offset + pos, bit) - orank;
     }
+    // Returns the bit at pos and sets *rank = rank(pos, bit).
+    bool accessRank(size_t pos, size_t* rank) const {
+      assert(pos <= len);
+      bool bit = vec->accessRank(offset + pos, rank);
+      *rank -= bit ? begin_rank : offset - begin_rank;
+      return bit;
+    }
     size_t select(size_t idx, bool bit) const {
       size_t orank = bit ? begin_rank : offset - begin_rank;
       return vec->select(idx + orank, bit) - offset;
@@ -243,18 +317,34 @@ class BalancedWavelet {
     Iterator(const Iterator& parent, bool right) : vec(parent.vec) {
       bit = parent.bit - 1;
       level_skip = parent.level_skip;
-      if (right) {
-        offset = parent.offset + level_skip + (parent.len - parent.end_rank);
-        len = parent.end_rank;
-        high_bits = parent.high_bits + (1LL << parent.bit);
-      } else {
-        offset = parent.offset + level_skip;
-        high_bits = parent.high_bits;
-        len = parent.len - parent.end_rank;
+      high_bits = parent.high_bits + (uint64_t(right) << parent.bit);
+      node = 0;
+      bounds = nullptr;
+      cached_nodes = 0;
+      if (parent.bounds != nullptr && 2 * parent.node + right <
+                                      parent.cached_nodes) {
+        // Node n ends where node n + 1 starts, also across levels.
+        node = 2 * parent.node + right;
+        bounds = parent.bounds;
+        cached_nodes = parent.cached_nodes;
+        offset = bounds[node].offset;
+        len = bounds[node + 1].offset - offset;
+        begin_rank = bounds[node].rank;
+        end_rank = bounds[node + 1].rank - begin_rank;
+        return;
       }
+      offset = parent.childOffset(right);
+      len = right ? parent.end_rank : parent.len - parent.end_rank;
       begin_rank = vec->rank(offset, 1);
       end_rank = vec->rank(offset + len, 1) - begin_rank;
     }
+    // Offset of child right, without the ranks child() computes.
+    size_t childOffset(bool right) const {
+      if (bounds != nullptr && 2 * node + right < cached_nodes) {
+        return bounds[2 * node + right].offset;
+      }
+      return offset + level_skip + (right ? len - end_rank : 0);
+    }
     uint64_t high_bits;
     size_t len;
     size_t offset;
@@ -263,6 +353,11 @@ class BalancedWavelet {
     size_t end_rank;
     size_t level_skip;
     const BitVector* vec;
+    // Heap index of the node, root is 1, and the node cache while the
+    // node is in it.
+    size_t node;
+    const NodeBound* bounds;
+    size_t cached_nodes;
     friend class BalancedWavelet;
   };
 
@@ -295,15 +390,31 @@ class BalancedWavelet {
     return pos + ret;
   }
 
+  // One accessRank per level, and two ranks for each child entered
+  // except the leaf, where only its offset is needed to read the bit.
   uint64_t operator[](size_t i) const {
     Iterator it(*this);
-    while (!it.isLeaf()) {
-      bool b = it[i];
-      Iterator nit = it.child(b);
-      i = it.rank(i, b);
-      it = nit;
+    if (it.isLeaf()) return it[i];
+    for (;;) {
+      bool b = it.accessRank(i, &i);
+      if (it.bit == 1) {
+        return it.high_bits + (uint64_t(b) << 1) +
+               (*it.vec)[it.childOffset(b) + i];
+      }
+      it = it.child(b);
     }
-    return it.high_bits + it[i];
+  }
+
+  // Writes the values in positions [l, r) to out. Walks the tree once:
+  // each node extracts its children's subranges and merges them back by
+  // reading its own bits in order, so the cost is O((r - l) log sigma)
+  // sequential bit reads plus two ranks per visited node, instead of
+  // r - l root-to-leaf traversals.
+  void extract(size_t l, size_t r, uint64_t* out) const {
+    assert(l <= r && r <= size());
+    if (l == r) return;
+    std::vector<uint64_t> tmp(r - l);
+    extract(Iterator(*this), l, r, out, &tmp[0]);
   }
 
   size_t select(size_t rank, uint64_t value) const {
@@ -311,25 +422,623 @@ class BalancedWavelet {
   }
 
   size_t select(Iterator it, size_t rank, uint64_t value) const {
-    if (it.count() == 0) return 0;
     if (rank == 0) return 0;
-    bool b = value >= it.splitValue();
-    if (it.isLeaf()) {
-      return it.select(rank, b);
+    // Walk down recording what Iterator::select needs of each node, then
+    // select back up. Steps are assigned before they are read.
+    struct Step {
+      size_t offset;
+      size_t begin_rank;
+      bool right;
+    };
+    Step path[MaxBits];
+    const BitVector* vec = it.vec;
+    int depth = 0;
+    for (;;) {
+      if (it.count() == 0) return 0;
+      bool right = value >= it.splitValue();
+      path[depth++] = Step{it.offset, it.begin_rank, right};
+      if (it.isLeaf()) break;
+      it = it.child(right);
+    }
+    while (depth > 0) {
+      const Step& s = path[--depth];
+      size_t orank = s.right ? s.begin_rank : s.offset - s.begin_rank;
+      rank = vec->select(rank + orank, s.right) - s.offset;
+    }
+    return rank;
+  }
+
+  // Stores the offset and rank of every node in the top levels, so that
+  // Iterator::child needs no rank calls there: rank, rankLE, select and
+  // operator[] then only rank at the query position on those levels.
+  // Takes 2^levels * 128 bits. levels = 0 drops the cache. levels is
+  // clamped to the tree height and to 2^levels <= size(): below that the
+  // nodes hold less than one value on average, so the cache would take
+  // more than 128 bits per value.
+  void cacheNodes(int levels) {
+    levels = std::min(levels, bits_);
+    levels = std::min<int>(levels, int(BitWidth(size_)) - 1);
+    bounds_.clear();
+    if (levels <= 0) {
+      bounds_.shrink_to_fit();
+      return;
     }
-    rank = select(it.child(b), rank, value);
-    return it.select(rank, b);
+    const size_t nodes = size_t(1) << levels;
+    std::vector<NodeBound> bounds(nodes + 1);
+    // Fill level by level without the cache. An empty node gets the
+    // offset where it would start, which is where the next one starts.
+    std::vector<Iterator> level(1, Iterator(*this));
+    for (int d = 0; d < levels; ++d) {
+      std::vector<Iterator> next;
+      for (size_t j = 0; j < level.size(); ++j) {
+        const Iterator& it = level[j];
+        bounds[(size_t(1) << d) + j] = NodeBound{it.offset, it.begin_rank};
+        if (d + 1 < levels) {
+          next.push_back(it.child(0));
+          next.push_back(it.child(1));
+        }
+      }
+      level.swap(next);
+    }
+    bounds[nodes] = NodeBound{levels * size_,
+                              tree_.rank(levels * size_, 1)};
+    bounds_.swap(bounds);
+  }
+
+  // Returns the k:th smallest value, counting from 0, in positions [l, r).
+  // One pair of ranks per level: the zeros in [l, r) of a node are the
+  // values in its left child.
+  uint64_t quantile(size_t l, size_t r, size_t k) const {
+    assert(l <= r && r <= size());
+    assert(k < r - l);
+    Iterator it(*this);
+    for (;;) {
+      size_t zl = it.rank(l, 0);
+      size_t zr = it.rank(r, 0);
+      bool bit = k >= zr - zl;
+      if (bit) {
+        k -= zr - zl;
+        l -= zl;
+        r -= zr;
+      } else {
+        l = zl;
+        r = zr;
+      }
+      if (it.isLeaf()) return it.high_bits + bit;
+      it = it.child(bit);
+    }
+  }
+
+  // Lower median of positions [l, r), which must not be empty.
+  uint64_t rangeMedian(size_t l, size_t r) const {
+    return quantile(l, r, (r - l - 1) / 2);
+  }
+
+  // Returns the k most frequent values in positions [l, r) with their
+  // counts, most frequent first. Ties are broken arbitrarily.
+  // Best-first traversal: nodes are expanded in order of the number of
+  // values of [l, r) they hold, so a value is final once it is the largest
+  // entry. Visits O(k log sigma) nodes when the counts are distinct.
+  std::vector<std::pair<uint64_t, size_t>> topKFrequent(size_t l, size_t r,
+                                                        size_t k) const {
+    assert(l <= r && r <= size());
+    std::vector<std::pair<uint64_t, size_t>> ret;
+    if (l == r || k == 0) return ret;
+    struct Entry {
+      size_t count;
+      // A node, or a single value if leaf_value.
+      bool leaf_value;
+      uint64_t value;
+      size_t l;
+      Iterator it;
+      bool operator<(const Entry& o) const {
+        return count < o.count;
+      }
+    };
+    std::priority_queue<Entry> queue;
+    queue.push(Entry{r - l, false, 0, l, Iterator(*this)});
+    while (!queue.empty() && ret.size() < k) {
+      Entry e = queue.top();
+      queue.pop();
+      if (e.leaf_value) {
+        ret.emplace_back(e.value, e.count);
+        continue;
+      }
+      const Iterator& it = e.it;
+      size_t zl = it.rank(e.l, 0);
+      size_t zr = it.rank(e.l + e.count, 0);
+      size_t count[2] = {zr - zl, e.count - (zr - zl)};
+      size_t begin[2] = {zl, e.l - zl};
+      for (int b = 0; b < 2; ++b) {
+        if (count[b] == 0) continue;
+        if (it.isLeaf()) {
+          queue.push(Entry{count[b], true, it.high_bits + b, 0, Iterator()});
+        } else {
+          queue.push(Entry{count[b], false, 0, begin[b], it.child(b)});
+        }
+      }
+    }
+    return ret;
+  }
+
+  // Calls f(value, count) for every distinct value in positions [l, r), in
+  // increasing order of value. Depth-first, skipping empty subranges, so
+  // the cost is O(d log sigma) for d distinct values.
+  template<typename F>
+  void forEachDistinct(size_t l, size_t r, F f) const {
+    assert(l <= r && r <= size());
+    if (l < r) forEachDistinct(Iterator(*this), l, r, f);
+  }
+
+  // Calls f(value, count1, count2) for every value that occurs in both
+  // positions [l1, r1) and [l2, r2), in increasing order of value, with its
+  // counts in each range.
+  template<typename F>
+  void rangeIntersect(size_t l1, size_t r1, size_t l2, size_t r2, F f) const {
+    assert(l1 <= r1 && r1 <= size());
+    assert(l2 <= r2 && r2 <= size());
+    if (l1 < r1 && l2 < r2) rangeIntersect(Iterator(*this), l1, r1, l2, r2, f);
+  }
+
+  // Sets *value to the smallest value >= x in positions [l, r). Returns
+  // false if there is none. One traversal that backtracks at most once:
+  // after leaving the path of x it takes the leftmost nonempty child.
+  bool rangeNextValue(size_t l, size_t r, uint64_t x, uint64_t* value) const {
+    assert(l <= r && r <= size());
+    if (l == r) return false;
+    if (bits_ < 64 && x >> bits_ != 0) return false;
+    return rangeNextValue(Iterator(*this), l, r, x, value);
+  }
+
+  // Sets *value to the largest value <= x in positions [l, r). Returns
+  // false if there is none.
+  bool rangePrevValue(size_t l, size_t r, uint64_t x, uint64_t* value) const {
+    assert(l <= r && r <= size());
+    if (l == r) return false;
+    return rangePrevValue(Iterator(*this), l, r, x, value);
+  }
+
+  // Number of values in [lo, hi] in positions [l, r). Both boundaries
+  // follow one path until they fall into different children, and then one
+  // path each, instead of four rankLE traversals.
+  size_t countRange(size_t l, size_t r, uint64_t lo, uint64_t hi) const {
+    assert(l <= r && r <= size());
+    if (l >= r || lo > hi) return 0;
+    if (bits_ < 64) {
+      if (lo >> bits_ != 0) return 0;
+      hi = std::min(hi, (uint64_t(1) << bits_) - 1);
+    }
+    Iterator it(*this);
+    for (;;) {
+      bool blo = lo >= it.splitValue();
+      bool bhi = hi >= it.splitValue();
+      size_t nl = it.rank(l, blo);
+      size_t nr = it.rank(r, blo);
+      if (blo != bhi) {
+        // lo goes left and hi right.
+        size_t count0 = nr - nl;
+        size_t count1 = (r - l) - count0;
+        if (it.isLeaf()) return count0 + count1;
+        return countSide(it.child(0), nl, nr, lo, true) +
+               countSide(it.child(1), l - nl, r - nr, hi, false);
+      }
+      l = nl;
+      r = nr;
+      if (l == r || it.isLeaf()) return r - l;
+      it = it.child(blo);
+    }
+  }
+
+  struct Query {
+    size_t pos;
+    uint64_t value;
+  };
+
+  // out[i] = rankLE(queries[i].pos, queries[i].value) for i < n.
+  // The batch is split into up to threads parts of at least MinThreadItems
+  // queries, each answered one level at a time: queries are kept grouped
+  // by node with positions sorted within each node, so every node's
+  // offset and ranks are computed once and the ranks inside it read the
+  // tree in increasing order.
+  void rankLEBatch(const Query* queries, size_t n, size_t* out) const {
+    rankLEBatch(queries, n, out, std::thread::hardware_concurrency());
+  }
+
+  void rankLEBatch(const Query* queries, size_t n, size_t* out,
+                   unsigned threads) const {
+    threads = std::max<size_t>(1, std::min<size_t>(threads,
+                                                   n / MinThreadItems));
+    ParallelFor(threads, [&](unsigned t) {
+      size_t begin = n * t / threads;
+      size_t end = n * (t + 1) / threads;
+      rankLEBatchPart(queries + begin, end - begin, out + begin);
+    });
   }
 
   size_t size() const {
     return size_;
   }
   size_t bitSize() const {
-    return tree_.bitSize() + sizeof(*this) * 8;
+    return tree_.bitSize() + bounds_.size() * sizeof(NodeBound) * 8 +
+           sizeof(*this) * 8;
+  }
+
+  // Writes the tree to path, BitVector must support save.
+  // Returns false on I/O error.
+  bool save(const char* path) const {
+    BalancedWaveletFileHeader h = {
+      BalancedWaveletFileHeader::Magic, size_, uint64_t(bits_)
+    };
+    return tree_.save(path, &h, sizeof(h));
+  }
+
+  // Maps a file written by save or BalancedWaveletFileBuilder, BitVector
+  // must be a view such as FastBitVectorView.
+  // Returns false if path is not a valid file.
+  bool open(const char* path) {
+    BalancedWaveletFileHeader h;
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr) return false;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1;
+    fclose(f);
+    if (!ok || h.magic != BalancedWaveletFileHeader::Magic) return false;
+    BitVector tree;
+    if (!tree.open(path, BalancedWaveletFileHeader::TreeOffset)) return false;
+    tree_ = std::move(tree);
+    bounds_.clear();
+    size_ = h.size;
+    bits_ = h.bits;
+    return true;
   }
  private:
+  struct BatchQuery {
+    size_t pos;
+    uint64_t value;
+    // Count of smaller values found so far.
+    size_t smaller;
+    size_t index;
+  };
+  // Queries [previous end, end) are in the node of it.
+  struct BatchGroup {
+    Iterator it;
+    size_t end;
+  };
+
+  void rankLEBatchPart(const Query* queries, size_t n, size_t* out) const {
+    if (size_ == 0) {
+      std::fill(out, out + n, 0);
+      return;
+    }
+    // rankLE(pos, value) = pos for values past the largest one, and they
+    // must stay on the path of the largest value to keep nodes contiguous.
+    const uint64_t max = bits_ < 64 ? (uint64_t(1) << bits_) - 1 : ~0ull;
+    std::vector<BatchQuery> cur(n), next(n);
+    for (size_t i = 0; i < n; ++i) {
+      cur[i] = BatchQuery{queries[i].pos, std::min(queries[i].value, max),
+                          0, i};
+    }
+    std::sort(cur.begin(), cur.end(),
+              [](const BatchQuery& a, const BatchQuery& b) {
+      return a.pos < b.pos;
+    });
+    std::vector<BatchGroup> groups(1, BatchGroup{Iterator(*this), n});
+    std::vector<BatchGroup> next_groups;
+    for (int level = 0; level < bits_; ++level) {
+      next_groups.clear();
+      size_t begin = 0;
+      for (const BatchGroup& g : groups) {
+        const Iterator& it = g.it;
+        const uint64_t split = it.splitValue();
+        // Stable partition by the bit, which keeps positions sorted.
+        size_t left = begin;
+        for (size_t i = begin; i < g.end; ++i) {
+          left += cur[i].value < split;
+        }
+        size_t l = begin, r = left;
+        for (size_t i = begin; i < g.end; ++i) {
+          BatchQuery q = cur[i];
+          bool bit = q.value >= split;
+          size_t np = it.rank(q.pos, bit);
+          if (bit) q.smaller += q.pos - np;
+          q.pos = np;
+          next[bit ? r++ : l++] = q;
+        }
+        if (!it.isLeaf()) {
+          if (begin < left) {
+            next_groups.push_back(BatchGroup{it.child(0), left});
+          }
+          if (left < g.end) {
+            next_groups.push_back(BatchGroup{it.child(1), g.end});
+          }
+        }
+        begin = g.end;
+      }
+      cur.swap(next);
+      groups.swap(next_groups);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      out[cur[i].index] = cur[i].pos + cur[i].smaller;
+    }
+  }
+
+  // Writes the values of positions [l, r) of the node of it to out, using
+  // tmp of the same size as scratch. Children write to tmp using out as
+  // their scratch.
+  void extract(const Iterator& it, size_t l, size_t r, uint64_t* out,
+               uint64_t* tmp) const {
+    if (it.isLeaf()) {
+      for (size_t i = l; i < r; ++i) {
+        out[i - l] = it.high_bits + it[i];
+      }
+      return;
+    }
+    size_t zl = it.rank(l, 0);
+    size_t zr = it.rank(r, 0);
+    size_t zeros = zr - zl;
+    if (zeros != 0) extract(it.child(0), zl, zr, tmp, out);
+    if (zeros != r - l) {
+      extract(it.child(1), l - zl, r - zr, tmp + zeros, out + zeros);
+    }
+    const uint64_t* next[2] = {tmp, tmp + zeros};
+    for (size_t i = l; i < r; ++i) {
+      out[i - l] = *next[it[i]]++;
+    }
+  }
+
+  bool rangeNextValue(const Iterator& it, size_t l, size_t r, uint64_t x,
+                      uint64_t* value) const {
+    size_t zl = it.rank(l, 0);
+    size_t zr = it.rank(r, 0);
+    bool left = zl < zr;
+    bool right = l - zl < r - zr;
+    if (x < it.splitValue()) {
+      if (left) {
+        if (it.isLeaf()) {
+          *value = it.high_bits;
+          return true;
+        }
+        if (rangeNextValue(it.child(0), zl, zr, x, value)) return true;
+      }
+    }
+    if (!right) return false;
+    if (it.isLeaf()) {
+      *value = it.high_bits + 1;
+      return true;
+    }
+    return rangeNextValue(it.child(1), l - zl, r - zr, x, value);
+  }
+
+  bool rangePrevValue(const Iterator& it, size_t l, size_t r, uint64_t x,
+                      uint64_t* value) const {
+    size_t zl = it.rank(l, 0);
+    size_t zr = it.rank(r, 0);
+    bool left = zl < zr;
+    bool right = l - zl < r - zr;
+    if (x >= it.splitValue()) {
+      if (right) {
+        if (it.isLeaf()) {
+          *value = it.high_bits + 1;
+          return true;
+        }
+        if (rangePrevValue(it.child(1), l - zl, r - zr, x, value)) {
+          return true;
+        }
+      }
+    }
+    if (!left) return false;
+    if (it.isLeaf()) {
+      *value = it.high_bits;
+      return true;
+    }
+    return rangePrevValue(it.child(0), zl, zr, x, value);
+  }
+
+  template<typename F>
+  void forEachDistinct(const Iterator& it, size_t l, size_t r, F& f) const {
+    size_t zl = it.rank(l, 0);
+    size_t zr = it.rank(r, 0);
+    if (it.isLeaf()) {
+      if (zl < zr) f(it.high_bits, zr - zl);
+      if (l - zl < r - zr) f(it.high_bits + 1, (r - zr) - (l - zl));
+      return;
+    }
+    if (zl < zr) forEachDistinct(it.child(0), zl, zr, f);
+    if (l - zl < r - zr) forEachDistinct(it.child(1), l - zl, r - zr, f);
+  }
+
+  template<typename F>
+  void rangeIntersect(const Iterator& it, size_t l1, size_t r1,
+                      size_t l2, size_t r2, F& f) const {
+    size_t zl1 = it.rank(l1, 0);
+    size_t zr1 = it.rank(r1, 0);
+    size_t zl2 = it.rank(l2, 0);
+    size_t zr2 = it.rank(r2, 0);
+    bool left = zl1 < zr1 && zl2 < zr2;
+    bool right = l1 - zl1 < r1 - zr1 && l2 - zl2 < r2 - zr2;
+    if (it.isLeaf()) {
+      if (left) f(it.high_bits, zr1 - zl1, zr2 - zl2);
+      if (right) {
+        f(it.high_bits + 1, (r1 - zr1) - (l1 - zl1),
+          (r2 - zr2) - (l2 - zl2));
+      }
+      return;
+    }
+    if (left) rangeIntersect(it.child(0), zl1, zr1, zl2, zr2, f);
+    if (right) {
+      rangeIntersect(it.child(1), l1 - zl1, r1 - zr1, l2 - zl2, r2 - zr2, f);
+    }
+  }
+
+  // Number of values >= x (if greater) or <= x in positions [l, r) of the
+  // node of it.
+  size_t countSide(Iterator it, size_t l, size_t r, uint64_t x,
+                   bool greater) const {
+    size_t ret = 0;
+    for (;;) {
+      if (l == r) return ret;
+      bool b = x >= it.splitValue();
+      size_t nl = it.rank(l, b);
+      size_t nr = it.rank(r, b);
+      if (b != greater) {
+        // The other child is entirely on the counted side.
+        ret += (r - l) - (nr - nl);
+      }
+      if (it.isLeaf()) return ret + nr - nl;
+      l = nl;
+      r = nr;
+      it = it.child(b);
+    }
+  }
+
+  // Chunks per thread need at least this many values.
+  static const size_t MinThreadItems = 1 << 16;
+
+  // Runs f(t) for t in [0, threads), on threads threads.
+  template<typename F>
+  static void ParallelFor(unsigned threads, const F& f) {
+    if (threads == 1) {
+      f(0);
+      return;
+    }
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+      pool.emplace_back(f, t);
+    }
+    for (auto& th : pool) th.join();
+  }
+
+  // Sets bit level + i of words to bit shift of vec[i] for i in [begin, end).
+  // Returns the number of zeros.
+  template<typename IntType>
+  static size_t EmitLevel(const IntType* vec, size_t begin, size_t end,
+                          int shift, size_t level, unsigned long* words) {
+    size_t ones = 0;
+    unsigned long w = 0;
+    for (size_t i = begin; i < end; ++i) {
+      size_t g = level + i;
+      unsigned long bit = (uint64_t(vec[i]) >> shift) & 1;
+      w |= bit << (g % 64);
+      ones += bit;
+      if (g % 64 == 63) {
+        words[g / 64] |= w;
+        w = 0;
+      }
+    }
+    if (begin < end && (level + end) % 64 != 0) {
+      words[(level + end - 1) / 64] |= w;
+    }
+    return (end - begin) - ones;
+  }
+
+  // Stable partition of every block of values sharing the bits above shift
+  // by bit shift, for the values in chunk t of cur, written to next.
+  // Value i with bit 0 goes to block_begin + Z(i) - Z(block_begin) and with
+  // bit 1 to i - Z(i) + Z(block_end), where Z(i) counts zeros before i.
+  template<typename IntType>
+  static void PartitionChunk(const IntType* cur, IntType* next, size_t size,
+                             int shift, const std::vector<size_t>& start,
+                             const std::vector<size_t>& zeros, unsigned t) {
+    auto key = [&](size_t i) -> uint64_t {
+      return shift + 1 >= 64 ? 0 : uint64_t(cur[i]) >> (shift + 1);
+    };
+    auto is_zero = [&](size_t i) -> bool {
+      return ((uint64_t(cur[i]) >> shift) & 1) == 0;
+    };
+    // Z(p) for any p, counting from the chunk containing p.
+    auto zeros_at = [&](size_t p) -> size_t {
+      size_t c = std::upper_bound(start.begin(), start.end() - 1, p) -
+                 start.begin() - 1;
+      size_t z = zeros[c];
+      for (size_t i = start[c]; i < p; ++i) z += is_zero(i);
+      return z;
+    };
+    const size_t begin = start[t], end = start[t + 1];
+    size_t z = zeros[t];
+    for (size_t i = begin; i < end;) {
+      const uint64_t k = key(i);
+      size_t block_begin = i, block_zeros = z;
+      if (i == begin && i > 0 && key(i - 1) == k) {
+        size_t lo = 0, hi = i;
+        while (lo < hi) {
+          size_t m = (lo + hi) / 2;
+          if (key(m) < k) lo = m + 1; else hi = m;
+        }
+        block_begin = lo;
+        block_zeros = zeros_at(lo);
+      }
+      size_t j = i, end_zeros = z;
+      for (; j < end && key(j) == k; ++j) end_zeros += is_zero(j);
+      const size_t run_end = j;
+      if (j == end && j < size && key(j) == k) {
+        size_t lo = j, hi = size;
+        while (lo < hi) {
+          size_t m = (lo + hi) / 2;
+          if (key(m) <= k) lo = m + 1; else hi = m;
+        }
+        end_zeros = zeros_at(lo);
+      }
+      for (; i < run_end; ++i) {
+        if (is_zero(i)) {
+          next[block_begin + z - block_zeros] = cur[i];
+          ++z;
+        } else {
+          next[i - z + end_zeros] = cur[i];
+        }
+      }
+    }
+  }
+
+  // Stable partition of [first, last), values with pred first. Uses at
+  // most buffer_size values of buffer, larger ranges are split in half and
+  // joined with a rotation. Returns the partition point.
+  template<typename IntType, typename Pred>
+  static IntType* StablePartition(IntType* first, IntType* last, Pred pred,
+                                  IntType* buffer, size_t buffer_size) {
+    size_t n = last - first;
+    if (n <= std::max<size_t>(1, buffer_size)) {
+      if (n == 1) return pred(*first) ? last : first;
+      IntType* out = first;
+      IntType* rest = buffer;
+      for (IntType* p = first; p != last; ++p) {
+        if (pred(*p)) *out++ = *p;
+        else *rest++ = *p;
+      }
+      std::copy(buffer, rest, out);
+      return out;
+    }
+    IntType* middle = first + n / 2;
+    IntType* a = StablePartition(first, middle, pred, buffer, buffer_size);
+    IntType* b = StablePartition(middle, last, pred, buffer, buffer_size);
+    std::rotate(a, middle, b);
+    return a + (b - middle);
+  }
+
+  // Partitions every block of values sharing the bits above shift by bit
+  // shift, in place.
+  template<typename IntType>
+  static void PartitionLevel(IntType* vec, size_t size, int shift,
+                             IntType* buffer, size_t buffer_size) {
+    auto key = [&](IntType x) -> uint64_t {
+      return shift + 1 >= 64 ? 0 : uint64_t(x) >> (shift + 1);
+    };
+    auto is_zero = [&](IntType x) -> bool {
+      return ((uint64_t(x) >> shift) & 1) == 0;
+    };
+    size_t start = 0;
+    for (size_t i = 1; i <= size; ++i) {
+      if (i == size || key(vec[i]) != key(vec[start])) {
+        StablePartition(&vec[start], &vec[i], is_zero, buffer, buffer_size);
+        start = i;
+      }
+    }
+  }
+
+  static const int MaxBits = 64;
 
   BitVector tree_;
+  // Heap ordered node bounds of the top levels, see cacheNodes. Entry
+  // 2^levels is the start of the first level not cached.
+  std::vector<NodeBound> bounds_;
   size_t size_;
   int bits_;
 };
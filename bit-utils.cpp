@@ -1,20 +1,238 @@
 #include "bit-utils.h"
 
-uint8_t BytePop[256];
-uint8_t ByteSelect[256][8];
-
-int BUInitTables() {
-  for (int x = 0; x < 256; ++x) {
-    BytePop[x] = __builtin_popcountll(x);
-  }
-  for (int x = 0; x < 256; ++x) {
-    int r = 0;
-    for (int i = 0; i < 8; ++i) {
-      if ((x>>i)&1) {
-        ByteSelect[x][r] = i+1;
-        r++;
+#include <immintrin.h>
+
+// Popcount kernels.
+// The library is built without -march, so each kernel is compiled for its
+// own target and the fastest supported one is picked at load time.
+
+static inline __attribute__((always_inline))
+size_t PrefixPopcountImpl(const unsigned long* words, size_t nbits) {
+  size_t sum = 0;
+  size_t full = nbits / 64;
+  for (size_t i = 0; i < full; ++i) {
+    sum += __builtin_popcountll(words[i]);
+  }
+  unsigned rest = nbits % 64;
+  if (rest != 0) {
+    sum += __builtin_popcountll(words[full] & ((1ULL << rest) - 1));
+  }
+  return sum;
+}
+
+static inline __attribute__((always_inline))
+size_t WordScanImpl(const unsigned long* words, size_t n,
+                    size_t need, bool bit, size_t* before) {
+  size_t sum = 0;
+  for (size_t w = 0; w < n; ++w) {
+    size_t pop = __builtin_popcountll(words[w]);
+    size_t c = bit ? pop : 64 - pop;
+    if (sum + c >= need) {
+      *before = sum;
+      return w;
+    }
+    sum += c;
+  }
+  *before = sum;
+  return n;
+}
+
+static size_t PrefixPopcountGeneric(const unsigned long* words, size_t nbits) {
+  return PrefixPopcountImpl(words, nbits);
+}
+
+static size_t WordScanGeneric(const unsigned long* words, size_t n,
+                              size_t need, bool bit, size_t* before) {
+  return WordScanImpl(words, n, need, bit, before);
+}
+
+__attribute__((target("popcnt")))
+static size_t PrefixPopcountPopcnt(const unsigned long* words, size_t nbits) {
+  return PrefixPopcountImpl(words, nbits);
+}
+
+__attribute__((target("popcnt")))
+static size_t WordScanPopcnt(const unsigned long* words, size_t n,
+                             size_t need, bool bit, size_t* before) {
+  return WordScanImpl(words, n, need, bit, before);
+}
+
+// Per 64-bit lane popcount of four words using pshufb nibble lookup.
+__attribute__((target("avx2")))
+static inline __m256i Popcount256(__m256i v) {
+  const __m256i lookup = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low));
+  __m256i hi = _mm256_shuffle_epi8(
+      lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t PrefixPopcountAvx2(const unsigned long* words, size_t nbits) {
+  size_t full = nbits / 64;
+  size_t i = 0;
+  size_t sum = 0;
+  if (full >= 4) {
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 4 <= full; i += 4) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(words + i));
+      acc = _mm256_add_epi64(acc, Popcount256(v));
+    }
+    sum = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+          _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+  }
+  return sum + PrefixPopcountImpl(words + i, nbits - 64 * i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t WordScanAvx2(const unsigned long* words, size_t n,
+                           size_t need, bool bit, size_t* before) {
+  size_t sum = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i c = Popcount256(_mm256_loadu_si256((const __m256i*)(words + i)));
+    if (!bit) c = _mm256_sub_epi64(_mm256_set1_epi64x(64), c);
+    uint64_t cnt[4];
+    _mm256_storeu_si256((__m256i*)cnt, c);
+    size_t total = cnt[0] + cnt[1] + cnt[2] + cnt[3];
+    if (sum + total >= need) {
+      for (int j = 0; ; ++j) {
+        if (sum + cnt[j] >= need) {
+          *before = sum;
+          return i + j;
+        }
+        sum += cnt[j];
+      }
+    }
+    sum += total;
+  }
+  size_t w = WordScanImpl(words + i, n - i, need - sum, bit, before);
+  *before += sum;
+  return i + w;
+}
+
+// Horizontal sum. _mm512_reduce_add_epi64 trips -Wuninitialized on gcc 12.
+__attribute__((target("avx512f")))
+static inline size_t Sum512(__m512i v) {
+  uint64_t lanes[8];
+  _mm512_storeu_si512(lanes, v);
+  size_t sum = 0;
+  for (int j = 0; j < 8; ++j) sum += lanes[j];
+  return sum;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+static size_t PrefixPopcountAvx512(const unsigned long* words, size_t nbits) {
+  size_t full = nbits / 64;
+  size_t i = 0;
+  __m512i acc = _mm512_setzero_si512();
+  for (; i + 8 <= full; i += 8) {
+    __m512i v = _mm512_loadu_si512(words + i);
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+  }
+  if (i < full) {
+    __mmask8 m = (1u << (full - i)) - 1;
+    __m512i v = _mm512_maskz_loadu_epi64(m, words + i);
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+  }
+  size_t sum = Sum512(acc);
+  unsigned rest = nbits % 64;
+  if (rest != 0) {
+    sum += __builtin_popcountll(words[full] & ((1ULL << rest) - 1));
+  }
+  return sum;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+static size_t WordScanAvx512(const unsigned long* words, size_t n,
+                             size_t need, bool bit, size_t* before) {
+  size_t sum = 0;
+  for (size_t i = 0; i < n; i += 8) {
+    __mmask8 m = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+    __m512i c = _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(m, words + i));
+    if (!bit) c = _mm512_maskz_sub_epi64(m, _mm512_set1_epi64(64), c);
+    uint64_t cnt[8];
+    _mm512_storeu_si512(cnt, c);
+    size_t total = 0;
+    for (int j = 0; j < 8; ++j) total += cnt[j];
+    if (sum + total >= need) {
+      for (int j = 0; ; ++j) {
+        if (sum + cnt[j] >= need) {
+          *before = sum;
+          return i + j;
+        }
+        sum += cnt[j];
       }
     }
+    sum += total;
   }
-  return 0;
+  *before = sum;
+  return n;
+}
+
+const PopcountKernel PopcountKernels[] = {
+  {"generic", PrefixPopcountGeneric, WordScanGeneric},
+  {"popcnt", PrefixPopcountPopcnt, WordScanPopcnt},
+  {"avx2", PrefixPopcountAvx2, WordScanAvx2},
+  {"avx512", PrefixPopcountAvx512, WordScanAvx512},
+};
+const int PopcountKernelCount =
+    sizeof(PopcountKernels) / sizeof(PopcountKernels[0]);
+
+bool PopcountKernelSupported(int kernel) {
+  __builtin_cpu_init();
+  switch (kernel) {
+    case 0: return true;
+    case 1: return __builtin_cpu_supports("popcnt");
+    case 2: return __builtin_cpu_supports("avx2") &&
+                   __builtin_cpu_supports("popcnt");
+    case 3: return __builtin_cpu_supports("avx512f") &&
+                   __builtin_cpu_supports("avx512vpopcntdq") &&
+                   __builtin_cpu_supports("popcnt");
+  }
+  return false;
+}
+
+static const PopcountKernel* ChosenPopcountKernel = nullptr;
+
+static void ChoosePopcountKernel() {
+  int k = PopcountKernelCount - 1;
+  while (!PopcountKernelSupported(k)) --k;
+  ChosenPopcountKernel = &PopcountKernels[k];
+  PrefixPopcount = ChosenPopcountKernel->prefixPopcount;
+  WordScan = ChosenPopcountKernel->wordScan;
+}
+
+// Used only if a kernel is called before static initialization of this file.
+static size_t PrefixPopcountResolve(const unsigned long* words, size_t nbits) {
+  ChoosePopcountKernel();
+  return PrefixPopcount(words, nbits);
+}
+
+static size_t WordScanResolve(const unsigned long* words, size_t n,
+                              size_t need, bool bit, size_t* before) {
+  ChoosePopcountKernel();
+  return WordScan(words, n, need, bit, before);
+}
+
+PrefixPopcountFn PrefixPopcount = PrefixPopcountResolve;
+WordScanFn WordScan = WordScanResolve;
+
+static int popcount_init = (ChoosePopcountKernel(), 0);
+
+// pdep is microcoded and slow on AMD families 15h and 17h (up to Zen 2).
+static bool HasFastPdep() {
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("bmi2")) return false;
+  return !__builtin_cpu_is("amdfam15h") && !__builtin_cpu_is("amdfam17h");
+}
+
+bool CpuHasFastPdep = HasFastPdep();
+
+const char* PopcountKernelName() {
+  if (ChosenPopcountKernel == nullptr) ChoosePopcountKernel();
+  return ChosenPopcountKernel->name;
 }
@@ -3,13 +3,65 @@
 #include <cstddef>
 #include <cassert>
 
-// Select for single word.
-//  v: Input value to find position with rank r.
-//  r: bit's desired rank [1-64].
-// Returns: First index i so that r == rank(v,i)
-int BUInitTables();
-extern uint8_t BytePop[256];
-extern uint8_t ByteSelect[256][8];
+// Set at load time if pdep is available and fast on this CPU.
+extern bool CpuHasFastPdep;
+
+// Number of bits needed to store x, 0 for x == 0.
+constexpr unsigned BitWidth(uint64_t x) {
+  return x == 0 ? 0 : 1 + BitWidth(x >> 1);
+}
+
+// Broadword select from Vigna's 'Broadword Implementation of Rank/Select
+// Queries.'
+//  k: 0-based rank of the wanted set bit.
+// Returns: position of that bit.
+static inline int BroadwordSelect(uint64_t x, int k) {
+  const uint64_t ones8 = 0x0101010101010101ULL;
+  const uint64_t msbs8 = 0x80 * ones8;
+  const uint64_t incr8 = 0x8040201008040201ULL;
+  // Byte-wise x <= y, one bit per byte.
+#define BU_ULEQ8(x, y) \
+  ((((((y) | msbs8) - ((x) & ~msbs8)) ^ (x) ^ (y)) & msbs8) >> 7)
+  // Cumulative popcounts of bytes.
+  uint64_t byte_sums = x - ((x & 0xAAAAAAAAAAAAAAAAULL) >> 1);
+  byte_sums = (byte_sums & 0x3333333333333333ULL) +
+              ((byte_sums >> 2) & 0x3333333333333333ULL);
+  byte_sums = (byte_sums + (byte_sums >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  byte_sums *= ones8;
+  // Find the byte, then the bit inside it.
+  const uint64_t k8 = k * ones8;
+  const int place = ((BU_ULEQ8(byte_sums, k8) * ones8) >> 53) & ~0x7;
+  const uint64_t byte_rank = k - (((byte_sums << 8) >> place) & 0xFF);
+  const uint64_t spread = ((x >> place) & 0xFF) * ones8 & incr8;
+  const uint64_t bit_sums =
+      ((((spread | ((spread | msbs8) - ones8)) & msbs8) >> 7) * ones8);
+  return place + ((BU_ULEQ8(bit_sums, byte_rank * ones8) * ones8) >> 56);
+#undef BU_ULEQ8
+}
+
+// Number of set bits among the first nbits bits of words.
+typedef size_t (*PrefixPopcountFn)(const unsigned long* words, size_t nbits);
+// Scans words for the first one where the running count of bit reaches need.
+// Returns the index w of that word and sets *before to the count in [0, w).
+// Returns n (and the total count in *before) if need is never reached.
+typedef size_t (*WordScanFn)(const unsigned long* words, size_t n,
+                             size_t need, bool bit, size_t* before);
+
+struct PopcountKernel {
+  const char* name;
+  PrefixPopcountFn prefixPopcount;
+  WordScanFn wordScan;
+};
+
+// All kernels, from slowest to fastest: generic, popcnt, avx2, avx512.
+extern const PopcountKernel PopcountKernels[];
+extern const int PopcountKernelCount;
+bool PopcountKernelSupported(int kernel);
+
+// Fastest kernels supported by this CPU, chosen at load time.
+extern PrefixPopcountFn PrefixPopcount;
+extern WordScanFn WordScan;
+const char* PopcountKernelName();
 
 
 // Select for single word.
@@ -17,16 +69,14 @@ extern uint8_t ByteSelect[256][8];
 //  r: bit's desired rank [1-64].
 // Returns: First index i so that r == rank(v,i)
 static inline int WordSelect(unsigned long v, int r) {
-  static int init = BUInitTables();
-  (void) init;
-  for (size_t b = 0; b < sizeof(long); ++b) {
-    int c = BytePop[v&255];
-    if (c >= r) {
-      return b * 8 + ByteSelect[v&255][r-1];
-    }
-    r -= c;
-    v >>= 8;
+  assert(r >= 1 && r <= __builtin_popcountll(v));
+#if defined(__x86_64__)
+  if (CpuHasFastPdep) {
+    // Deposit the r:th lowest bit into the set bits of v.
+    uint64_t bit;
+    asm("pdepq %2, %1, %0" : "=r"(bit) : "r"(1ULL << (r - 1)), "r"(v));
+    return __builtin_ctzll(bit) + 1;
   }
-  assert(false);
-  return -1;
+#endif
+  return BroadwordSelect(v, r - 1) + 1;
 }
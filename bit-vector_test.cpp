@@ -1,9 +1,13 @@
 #include<gtest/gtest.h>
 
+#include <fstream>
 #include <random>
 #include "fast-bit-vector.h"
+#include "dense-select-bit-vector.h"
+#include "interleaved-bit-vector.h"
 #include "sparse-bit-vector.h"
 #include "rrr-bit-vector.h"
+#include "dynamic-bit-vector.h"
 
 
 template<typename T>
@@ -13,8 +17,14 @@ class BitVectorTest : public ::testing::Test {
 
 typedef ::testing::Types<
   FastBitVector,
+  BasicFastBitVector<RankOnlySampling>,
+  BasicFastBitVector<SelectOnlySampling>,
+  BasicFastBitVector<FineSampling>,
+  InterleavedBitVector,
+  DenseSelectBitVector,
   SparseBitVector,
-  RRRBitVector
+  RRRBitVector,
+  DynamicBitVector
   > BitVectorTypes;
 
 TYPED_TEST_CASE(BitVectorTest, BitVectorTypes);
@@ -46,6 +56,24 @@ TYPED_TEST(BitVectorTest, RandomRank) {
   }
 }
 
+TYPED_TEST(BitVectorTest, AccessRank) {
+  std::mt19937_64 mt(0);
+  int n = 100000;
+  std::vector<bool> v;
+  for (int j = 0; j < n; ++j) {
+    v.push_back(mt()%5 == 0);
+  }
+  TypeParam vec(v);
+  size_t ranks[2] = {0, 0};
+  for (size_t j = 0; j < vec.size(); ++j) {
+    size_t rank;
+    bool bit = vec.accessRank(j, &rank);
+    ASSERT_EQ(v[j], bit) << " j = " << j;
+    ASSERT_EQ(ranks[bit], rank) << " j = " << j;
+    ranks[v[j]]++;
+  }
+}
+
 TYPED_TEST(BitVectorTest, ShortSelect) {
   std::vector<bool> v = {false, true, true, false, true};
   TypeParam vec(v);
@@ -101,3 +129,257 @@ TYPED_TEST(BitVectorTest, Edges) {
     ASSERT_EQ(j, vec.select(j,1)) << j;
   }
 }
+
+TEST(FastBitVectorTest, Batch) {
+  std::mt19937_64 mt(0);
+  int n = 1<<20;
+  std::vector<bool> v;
+  for (int j = 0; j < n; ++j) {
+    v.push_back(mt()%3 == 0);
+  }
+  FastBitVector vec(v);
+  std::vector<size_t> pos, idx[2];
+  for (int j = 0; j < 1000; ++j) {
+    pos.push_back(mt() % (n + 1));
+    idx[0].push_back(mt() % (vec.count(0) + 1));
+    idx[1].push_back(mt() % (vec.count(1) + 1));
+  }
+  std::vector<size_t> out(pos.size());
+  for (int b = 0; b < 2; ++b) {
+    vec.rankBatch(&pos[0], b, &out[0], pos.size());
+    for (size_t j = 0; j < pos.size(); ++j) {
+      ASSERT_EQ(vec.rank(pos[j], b), out[j]) << j;
+    }
+    vec.selectBatch(&idx[b][0], b, &out[0], idx[b].size());
+    for (size_t j = 0; j < idx[b].size(); ++j) {
+      ASSERT_EQ(vec.select(idx[b][j], b), out[j]) << j;
+    }
+  }
+}
+
+TEST(PopcountKernelTest, MatchesGeneric) {
+  std::mt19937_64 mt(0);
+  std::vector<unsigned long> words(64);
+  for (size_t i = 0; i < words.size(); ++i) {
+    // Mix dense, sparse and random words.
+    words[i] = i % 3 == 0 ? ~0UL : (i % 3 == 1 ? mt() & mt() & mt() : mt());
+  }
+  const PopcountKernel& generic = PopcountKernels[0];
+  for (int k = 1; k < PopcountKernelCount; ++k) {
+    if (!PopcountKernelSupported(k)) continue;
+    const PopcountKernel& kernel = PopcountKernels[k];
+    for (size_t nbits = 0; nbits < 64 * words.size(); nbits += 7) {
+      ASSERT_EQ(generic.prefixPopcount(&words[0], nbits),
+                kernel.prefixPopcount(&words[0], nbits))
+          << kernel.name << " nbits = " << nbits;
+    }
+    for (size_t n = 0; n <= 20; ++n) {
+      for (size_t need = 0; need < 64 * 21; need += 13) {
+        for (int bit = 0; bit < 2; ++bit) {
+          size_t b1, b2;
+          ASSERT_EQ(generic.wordScan(&words[0], n, need, bit, &b1),
+                    kernel.wordScan(&words[0], n, need, bit, &b2))
+              << kernel.name << " n = " << n << " need = " << need;
+          ASSERT_EQ(b1, b2) << kernel.name;
+        }
+      }
+    }
+  }
+}
+
+TEST(WordSelectTest, MatchesNaive) {
+  std::mt19937_64 mt(0);
+  for (int j = 0; j < 10000; ++j) {
+    uint64_t w = mt();
+    if (j % 3 == 1) w &= mt() & mt();
+    if (j % 3 == 2) w |= mt() | mt();
+    if (j == 0) w = ~0ULL;
+    int r = 0;
+    for (int i = 0; i < 64; ++i) {
+      if ((w >> i) & 1) {
+        ++r;
+        ASSERT_EQ(i + 1, WordSelect(w, r)) << w;
+        ASSERT_EQ(i, BroadwordSelect(w, r - 1)) << w;
+      }
+    }
+  }
+}
+
+TEST(FastBitVectorTest, SaveAndMap) {
+  std::mt19937_64 mt(0);
+  int n = 100000;
+  std::vector<bool> v;
+  for (int j = 0; j < n; ++j) {
+    v.push_back(mt()%3 == 0);
+  }
+  FastBitVector vec(v);
+  std::string path = ::testing::TempDir() + "fast-bit-vector_test.fbv";
+  ASSERT_TRUE(vec.save(path.c_str()));
+  FastBitVectorView view;
+  ASSERT_TRUE(view.open(path.c_str()));
+  ASSERT_EQ(vec.size(), view.size());
+  ASSERT_EQ(vec.count(1), view.count(1));
+  for (int j = 0; j < n; ++j) {
+    ASSERT_EQ(vec[j], view[j]) << j;
+    ASSERT_EQ(vec.rank(j, 1), view.rank(j, 1)) << j;
+  }
+  for (int b = 0; b < 2; ++b) {
+    for (size_t j = 0; j <= vec.count(b); ++j) {
+      ASSERT_EQ(vec.select(j, b), view.select(j, b)) << j;
+    }
+  }
+  BasicFastBitVectorView<FineSampling> other_sampling;
+  EXPECT_FALSE(other_sampling.open(path.c_str()));
+  // Header words are magic, size, popcount, word_count, rank_count and
+  // the select counts. Counts that disagree with size and popcount are
+  // rejected.
+  for (int field = 1; field < 7; ++field) {
+    std::fstream f(path.c_str(), std::ios::in | std::ios::out |
+                                 std::ios::binary);
+    uint64_t word;
+    f.seekg(field * 8);
+    f.read(reinterpret_cast<char*>(&word), 8);
+    uint64_t bad = field == 1 ? word * 2 : word - 1;
+    f.seekp(field * 8);
+    f.write(reinterpret_cast<const char*>(&bad), 8);
+    f.flush();
+    FastBitVectorView corrupt;
+    EXPECT_FALSE(corrupt.open(path.c_str())) << field;
+    f.seekp(field * 8);
+    f.write(reinterpret_cast<const char*>(&word), 8);
+  }
+  FastBitVectorView restored;
+  EXPECT_TRUE(restored.open(path.c_str()));
+  remove(path.c_str());
+  FastBitVectorView missing;
+  EXPECT_FALSE(missing.open(path.c_str()));
+}
+
+TEST(FastBitVectorTest, SamplingSize) {
+  std::vector<bool> v(1 << 20);
+  for (size_t j = 0; j < v.size(); j += 3) {
+    v[j] = true;
+  }
+  BasicFastBitVector<RankOnlySampling> rank_only(v);
+  BasicFastBitVector<SelectOnlySampling> select_only(v);
+  FastBitVector normal(v);
+  BasicFastBitVector<FineSampling> fine(v);
+  EXPECT_LT(select_only.bitSize(), rank_only.bitSize());
+  EXPECT_LT(rank_only.bitSize(), normal.bitSize());
+  EXPECT_LT(normal.bitSize(), fine.bitSize());
+}
+
+TEST(FastBitVectorTest, FromWords) {
+  std::mt19937_64 mt(0);
+  // Large enough to build the samples on several threads.
+  for (size_t n : {0, 1, 64, 1000, 1 << 24}) {
+    std::vector<unsigned long> words(1 + n / 64);
+    std::vector<bool> v(n);
+    for (size_t j = 0; j < words.size(); ++j) {
+      words[j] = mt() & mt();
+    }
+    for (size_t j = 0; j < n; ++j) {
+      v[j] = (words[j / 64] >> (j % 64)) & 1;
+    }
+    FastBitVector ref(v);
+    FastBitVector copied(&words[0], n);
+    std::unique_ptr<unsigned long[]> owned(new unsigned long[1 + n / 64]);
+    std::copy(words.begin(), words.end(), owned.get());
+    FastBitVector adopted(std::move(owned), n);
+    ASSERT_EQ(ref.count(1), copied.count(1));
+    ASSERT_EQ(ref.count(1), adopted.count(1));
+    for (size_t j = 0; j <= n; j += 1 + mt() % 1000) {
+      ASSERT_EQ(ref.rank(j, 1), copied.rank(j, 1)) << j;
+      ASSERT_EQ(ref.rank(j, 1), adopted.rank(j, 1)) << j;
+    }
+    for (int b = 0; b < 2; ++b) {
+      for (size_t j = 0; j <= ref.count(b); j += 1 + mt() % 1000) {
+        ASSERT_EQ(ref.select(j, b), copied.select(j, b)) << j;
+        ASSERT_EQ(ref.select(j, b), adopted.select(j, b)) << j;
+      }
+    }
+  }
+}
+
+TEST(DenseSelectBitVectorTest, DenseAndSparseRegions) {
+  std::mt19937_64 mt(0);
+  std::vector<bool> v;
+  // Mix regions of different density, so that dense blocks, sparse blocks
+  // and sparse sub-blocks are used for both bit values.
+  const int rarity[3] = {2, 32, 1 << 12};
+  for (int region = 0; region < 12; ++region) {
+    int n = region % 3 == 2 ? 1 << 18 : 1 << 16;
+    for (int j = 0; j < n; ++j) {
+      bool b = mt() % rarity[region % 3] == 0;
+      v.push_back(region % 6 < 3 ? b : !b);
+    }
+  }
+  FastBitVector ref(v);
+  DenseSelectBitVector vec(v);
+  for (int b = 0; b < 2; ++b) {
+    for (size_t j = 0; j <= ref.count(b); ++j) {
+      ASSERT_EQ(ref.select(j, b), vec.select(j, b)) << j;
+    }
+  }
+}
+
+// Checks vec against a naive copy after every round of updates.
+void CheckDynamicBitVector(const std::vector<char>& ref,
+                           const DynamicBitVector& vec) {
+  ASSERT_EQ(ref.size(), vec.size());
+  size_t ones = 0;
+  for (size_t i = 0; i < ref.size(); ++i) {
+    ASSERT_EQ(bool(ref[i]), vec[i]) << i;
+    ASSERT_EQ(ones, vec.rank(i, 1)) << i;
+    if (ref[i]) {
+      ++ones;
+      ASSERT_EQ(i + 1, vec.select(ones, 1)) << i;
+    } else {
+      ASSERT_EQ(i + 1, vec.select(i + 1 - ones, 0)) << i;
+    }
+  }
+  ASSERT_EQ(ones, vec.count(1));
+  ASSERT_EQ(ones, vec.rank(ref.size(), 1));
+}
+
+TEST(DynamicBitVectorTest, Updates) {
+  std::mt19937_64 mt(0);
+  // Reference as chars, which insert and erase much faster than bools.
+  std::vector<char> ref;
+  for (int i = 0; i < 20000; ++i) {
+    ref.push_back(mt() % 3 == 0);
+  }
+  DynamicBitVector vec(std::vector<bool>(ref.begin(), ref.end()));
+  CheckDynamicBitVector(ref, vec);
+  // Grow past a few levels of splits, then shrink back to force merges,
+  // with runs of inserts at the same place to fill single leaves.
+  for (int round = 0; round < 8; ++round) {
+    bool grow = round < 4;
+    for (int j = 0; j < 20000; ++j) {
+      size_t pos = j % 4 == 0 ? ref.size() / 3 : mt() % (ref.size() + 1);
+      int op = mt() % 8;
+      if (ref.empty() || op < (grow ? 5 : 2)) {
+        bool bit = mt() % 3 == 0;
+        vec.insert(pos, bit);
+        ref.insert(ref.begin() + pos, bit);
+      } else if (op < 7) {
+        pos = std::min(pos, ref.size() - 1);
+        ASSERT_EQ(bool(ref[pos]), vec.erase(pos)) << pos;
+        ref.erase(ref.begin() + pos);
+      } else {
+        pos = std::min(pos, ref.size() - 1);
+        bool bit = mt() % 2;
+        vec.set(pos, bit);
+        ref[pos] = bit;
+      }
+    }
+    CheckDynamicBitVector(ref, vec);
+  }
+  while (!ref.empty()) {
+    vec.erase(ref.size() - 1);
+    ref.pop_back();
+  }
+  CheckDynamicBitVector(ref, vec);
+  vec.insert(0, 1);
+  EXPECT_EQ(1, vec.select(1, 1));
+}
@@ -0,0 +1,174 @@
+#pragma once
+// FastBitVector with a constant time select index for both bit values.
+// The index is darray from D. Okanohara, K. Sadakane: 'Practical
+// Entropy-Compressed Rank/Select Dictionary'.
+
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <stdint.h>
+
+#include "fast-bit-vector.h"
+#include "bit-utils.h"
+
+// Select index over the positions of one bit value.
+// Occurrences are grouped in blocks of Block. A block spanning at least
+// 2^16 bits is sparse and stores all its positions. Other blocks store
+// their first position and the 16-bit offset of every Sub:th occurrence,
+// except that sub-blocks spanning over MaxSubSpan bits store the offsets of
+// all their occurrences. This bounds the final word scan to MaxSubSpan bits.
+class DArray {
+  static const unsigned Block = 1024;
+  static const unsigned Sub = 128;
+  static const unsigned SubsPerBlock = Block / Sub;
+  static const unsigned MaxSpan = 1 << 16;
+  static const unsigned MaxSubSpan = 2048;
+  static const uint64_t SparseFlag = 1ULL << 63;
+  // Everything select needs besides the bits, in 32 bytes.
+  struct BlockEntry {
+    // First position, or SparseFlag | index into explicit_.
+    uint64_t start;
+    // Offsets of sparse sub-blocks start from here in sub_explicit_.
+    uint32_t explicit_base;
+    // Offset of the first occurrence from start, or for sparse sub-blocks
+    // the index from explicit_base.
+    uint16_t sub[SubsPerBlock];
+    // Bit j is set if sub-block j is sparse.
+    uint8_t sparse_subs;
+  };
+ public:
+  DArray() : bit_(1), word_count_(0) { }
+
+  DArray(const unsigned long* words, size_t size, bool bit)
+      : bit_(bit),
+        word_count_((size + 63) / 64) {
+    std::vector<uint64_t> pos;
+    pos.reserve(Block);
+    for (size_t i = 0; i < word_count_; ++i) {
+      uint64_t w = bit ? words[i] : ~words[i];
+      if (i == size / 64) w &= (1ULL << (size % 64)) - 1;
+      while (w != 0) {
+        pos.push_back(i * 64 + __builtin_ctzll(w));
+        w &= w - 1;
+        if (pos.size() == Block) {
+          addBlock(pos);
+          pos.clear();
+        }
+      }
+    }
+    if (!pos.empty()) addBlock(pos);
+  }
+
+  // Position of the idx:th occurrence plus one, idx in [1, count].
+  size_t select(const unsigned long* words, size_t idx) const {
+    size_t i = idx - 1;
+    const BlockEntry& block = blocks_[i / Block];
+    if (block.start & SparseFlag) {
+      return explicit_[(block.start & ~SparseFlag) + i % Block] + 1;
+    }
+    size_t j = (i % Block) / Sub;
+    if ((block.sparse_subs >> j) & 1) {
+      size_t e = block.explicit_base + block.sub[j] + i % Sub;
+      return block.start + sub_explicit_[e] + 1;
+    }
+    size_t pos = block.start + block.sub[j];
+    size_t r = i % Sub;
+    // Find the r:th occurrence after pos, which is the 0:th.
+    size_t word = pos / 64;
+    uint64_t w = bit_ ? words[word] : ~words[word];
+    w &= ~0ULL << (pos % 64);
+    size_t c = __builtin_popcountll(w);
+    if (r >= c) {
+      r -= c;
+      ++word;
+      size_t before;
+      word += WordScan(&words[word],
+                       std::min<size_t>(word_count_ - word, MaxSubSpan / 64),
+                       r + 1, bit_, &before);
+      r -= before;
+      w = bit_ ? words[word] : ~words[word];
+    }
+    return word * 64 + WordSelect(w, r + 1);
+  }
+
+  size_t bitSize() const {
+    return 8 * sizeof(BlockEntry) * blocks_.size() +
+           16 * sub_explicit_.size() + 64 * explicit_.size() +
+           8 * sizeof(*this);
+  }
+
+ private:
+  void addBlock(const std::vector<uint64_t>& pos) {
+    BlockEntry block = {};
+    if (pos.back() - pos.front() >= MaxSpan) {
+      block.start = explicit_.size() | SparseFlag;
+      explicit_.insert(explicit_.end(), pos.begin(), pos.end());
+      blocks_.push_back(block);
+      return;
+    }
+    block.start = pos.front();
+    block.explicit_base = sub_explicit_.size();
+    for (size_t j = 0; j * Sub < pos.size(); ++j) {
+      size_t first = j * Sub;
+      size_t last = std::min<size_t>(first + Sub, pos.size()) - 1;
+      if (pos[last] - pos[first] > MaxSubSpan) {
+        block.sparse_subs |= 1 << j;
+        block.sub[j] = sub_explicit_.size() - block.explicit_base;
+        for (size_t k = first; k <= last; ++k) {
+          sub_explicit_.push_back(pos[k] - pos.front());
+        }
+      } else {
+        block.sub[j] = pos[first] - pos.front();
+      }
+    }
+    blocks_.push_back(block);
+  }
+
+  bool bit_;
+  size_t word_count_;
+  std::vector<BlockEntry> blocks_;
+  std::vector<uint16_t> sub_explicit_;
+  std::vector<uint64_t> explicit_;
+};
+
+// FastBitVector with O(1) select through a DArray per bit value.
+// Uses more space than the sampled select of FastBitVector.
+class DenseSelectBitVector : public FastBitVector {
+ public:
+  // Empty constructor.
+  DenseSelectBitVector() { }
+  explicit DenseSelectBitVector(const std::vector<bool>& data)
+      : FastBitVector(data),
+        select_{DArray(this->data(), size(), 0),
+                DArray(this->data(), size(), 1)} { }
+  DenseSelectBitVector(const DenseSelectBitVector& other) = delete;
+  DenseSelectBitVector(DenseSelectBitVector&& other) {
+    swap(*this, other);
+  }
+  const DenseSelectBitVector& operator=(DenseSelectBitVector&& other) {
+    swap(*this, other);
+    return *this;
+  }
+
+  // Returns smallest position pos so that rank(pos,bit) == idx
+  size_t select(size_t idx, bool bit) const {
+    if (idx == 0) return 0;
+    assert(idx <= count(bit));
+    return select_[bit].select(data(), idx);
+  }
+
+  size_t bitSize() const {
+    return FastBitVector::bitSize() + select_[0].bitSize() +
+           select_[1].bitSize();
+  }
+
+  friend void swap(DenseSelectBitVector& a, DenseSelectBitVector& b) {
+    using std::swap;
+    swap(static_cast<FastBitVector&>(a), static_cast<FastBitVector&>(b));
+    swap(a.select_[0], b.select_[0]);
+    swap(a.select_[1], b.select_[1]);
+  }
+
+ private:
+  DArray select_[2];
+};
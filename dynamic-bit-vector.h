@@ -0,0 +1,490 @@
+#ifndef DYNAMIC_BIT_VECTOR_H
+#define DYNAMIC_BIT_VECTOR_H
+
+#include "bit-utils.h"
+#include <stdint.h>
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+// Bit vector supporting insert, erase and set at any position in
+// O(log n), alongside rank, select and access.
+//
+// Bits are stored in leaf blocks of less than LeafBits bits, which are the
+// leaves of a B+ tree. Inner nodes store for every child the number of
+// bits and of ones below it, so queries walk down one path adding up
+// counters and finish with popcounts inside a single leaf. All leaves are
+// at the same depth. A node that becomes full is split in two, and a node
+// that drops below a quarter full is merged with a sibling, or the two
+// share their contents evenly if they do not fit in one node.
+class DynamicBitVector {
+  static const int WordBits = 64;
+  static const int LeafWords = 32;
+  static const size_t LeafBits = LeafWords * WordBits;
+  static const int Fanout = 16;
+
+  struct Leaf {
+    size_t size;
+    size_t ones;
+    // Bits past size are zero.
+    unsigned long words[LeafWords];
+  };
+  struct Inner {
+    int n;
+    size_t size[Fanout];
+    size_t ones[Fanout];
+    void* child[Fanout];
+  };
+
+ public:
+  DynamicBitVector() : root_(newLeaf()), height_(0), size_(0), ones_(0) { }
+
+  DynamicBitVector(const std::vector<bool>& vec) : DynamicBitVector() {
+    build(vec);
+  }
+
+  DynamicBitVector(const DynamicBitVector& o) = delete;
+
+  DynamicBitVector(DynamicBitVector&& o) : DynamicBitVector() {
+    swap(o);
+  }
+
+  const DynamicBitVector& operator=(DynamicBitVector&& o) {
+    swap(o);
+    return *this;
+  }
+
+  ~DynamicBitVector() {
+    destroy(root_, 0);
+  }
+
+  bool operator[](size_t pos) const {
+    assert(pos < size_);
+    size_t ones;
+    const Leaf* leaf = findLeaf(&pos, &ones);
+    return (leaf->words[pos / WordBits] >> (pos % WordBits)) & 1;
+  }
+
+  size_t rank(size_t pos, bool bit) const {
+    assert(pos <= size_);
+    const size_t total = pos;
+    const void* node = root_;
+    size_t ones = 0;
+    for (int d = 0; d < height_; ++d) {
+      const Inner* in = static_cast<const Inner*>(node);
+      int i = 0;
+      while (i + 1 < in->n && pos >= in->size[i]) {
+        pos -= in->size[i];
+        ones += in->ones[i];
+        ++i;
+      }
+      node = in->child[i];
+    }
+    ones += PrefixPopcount(static_cast<const Leaf*>(node)->words, pos);
+    return bit ? ones : total - ones;
+  }
+
+  // Returns the bit at pos and sets *rank = rank(pos, bit).
+  bool accessRank(size_t pos, size_t* rank) const {
+    assert(pos < size_);
+    const size_t total = pos;
+    size_t ones;
+    const Leaf* leaf = findLeaf(&pos, &ones);
+    bool bit = (leaf->words[pos / WordBits] >> (pos % WordBits)) & 1;
+    ones += PrefixPopcount(leaf->words, pos);
+    *rank = bit ? ones : total - ones;
+    return bit;
+  }
+
+  // Returns smallest position pos so that rank(pos, bit) == idx.
+  size_t select(size_t idx, bool bit) const {
+    if (idx == 0) return 0;
+    assert(idx <= count(bit));
+    const void* node = root_;
+    size_t pos = 0;
+    for (int d = 0; d < height_; ++d) {
+      const Inner* in = static_cast<const Inner*>(node);
+      int i = 0;
+      for (;; ++i) {
+        size_t c = bit ? in->ones[i] : in->size[i] - in->ones[i];
+        if (idx <= c) break;
+        idx -= c;
+        pos += in->size[i];
+      }
+      node = in->child[i];
+    }
+    const Leaf* leaf = static_cast<const Leaf*>(node);
+    for (int w = 0;; ++w) {
+      unsigned long x = bit ? leaf->words[w] : ~leaf->words[w];
+      size_t c = __builtin_popcountl(x);
+      if (idx <= c) return pos + w * WordBits + WordSelect(x, idx);
+      idx -= c;
+    }
+  }
+
+  // Inserts bit before position pos, pos == size() appends.
+  void insert(size_t pos, bool bit) {
+    assert(pos <= size_);
+    void* split = insert(root_, 0, pos, bit);
+    if (split != nullptr) {
+      Inner* root = new Inner();
+      root->n = 2;
+      root->child[0] = root_;
+      root->child[1] = split;
+      totals(root_, 0, &root->size[0], &root->ones[0]);
+      totals(split, 0, &root->size[1], &root->ones[1]);
+      root_ = root;
+      ++height_;
+    }
+    ++size_;
+    ones_ += bit;
+  }
+
+  // Removes the bit at pos and returns it.
+  bool erase(size_t pos) {
+    assert(pos < size_);
+    bool bit = erase(root_, 0, pos);
+    while (height_ > 0 && static_cast<Inner*>(root_)->n == 1) {
+      Inner* root = static_cast<Inner*>(root_);
+      root_ = root->child[0];
+      delete root;
+      --height_;
+    }
+    --size_;
+    ones_ -= bit;
+    return bit;
+  }
+
+  void set(size_t pos, bool bit) {
+    if ((*this)[pos] == bit) return;
+    const int delta = bit ? 1 : -1;
+    void* node = root_;
+    for (int d = 0; d < height_; ++d) {
+      Inner* in = static_cast<Inner*>(node);
+      int i = 0;
+      while (pos >= in->size[i]) {
+        pos -= in->size[i];
+        ++i;
+      }
+      in->ones[i] += delta;
+      node = in->child[i];
+    }
+    Leaf* leaf = static_cast<Leaf*>(node);
+    leaf->words[pos / WordBits] ^= 1ul << (pos % WordBits);
+    leaf->ones += delta;
+    ones_ += delta;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  size_t count(bool bit) const {
+    return bit ? ones_ : size_ - ones_;
+  }
+  size_t bitSize() const {
+    return sizeof(*this) * 8 + nodeBits(root_, 0);
+  }
+
+ private:
+  static Leaf* newLeaf() {
+    return new Leaf();
+  }
+
+  void swap(DynamicBitVector& o) {
+    std::swap(root_, o.root_);
+    std::swap(height_, o.height_);
+    std::swap(size_, o.size_);
+    std::swap(ones_, o.ones_);
+  }
+
+  void destroy(void* node, int d) {
+    if (d == height_) {
+      delete static_cast<Leaf*>(node);
+      return;
+    }
+    Inner* in = static_cast<Inner*>(node);
+    for (int i = 0; i < in->n; ++i) {
+      destroy(in->child[i], d + 1);
+    }
+    delete in;
+  }
+
+  size_t nodeBits(const void* node, int d) const {
+    if (d == height_) return sizeof(Leaf) * 8;
+    const Inner* in = static_cast<const Inner*>(node);
+    size_t ret = sizeof(Inner) * 8;
+    for (int i = 0; i < in->n; ++i) {
+      ret += nodeBits(in->child[i], d + 1);
+    }
+    return ret;
+  }
+
+  // Finds the leaf holding pos and makes pos relative to it. Sets *ones
+  // to the number of ones before the leaf.
+  const Leaf* findLeaf(size_t* pos, size_t* ones) const {
+    const void* node = root_;
+    *ones = 0;
+    for (int d = 0; d < height_; ++d) {
+      const Inner* in = static_cast<const Inner*>(node);
+      int i = 0;
+      while (*pos >= in->size[i]) {
+        *pos -= in->size[i];
+        *ones += in->ones[i];
+        ++i;
+      }
+      node = in->child[i];
+    }
+    return static_cast<const Leaf*>(node);
+  }
+
+  // Number of bits and ones below node at depth d.
+  void totals(const void* node, int d, size_t* size, size_t* ones) const {
+    if (d == height_) {
+      *size = static_cast<const Leaf*>(node)->size;
+      *ones = static_cast<const Leaf*>(node)->ones;
+      return;
+    }
+    const Inner* in = static_cast<const Inner*>(node);
+    *size = *ones = 0;
+    for (int i = 0; i < in->n; ++i) {
+      *size += in->size[i];
+      *ones += in->ones[i];
+    }
+  }
+
+  bool underfull(const void* node, int d) const {
+    if (d == height_) {
+      return static_cast<const Leaf*>(node)->size < LeafBits / 4;
+    }
+    return static_cast<const Inner*>(node)->n < Fanout / 4;
+  }
+
+  // Bits [pos, pos + len) of words, 0 < len <= 64.
+  static unsigned long getBits(const unsigned long* words, size_t pos,
+                               int len) {
+    size_t w = pos / WordBits;
+    int o = pos % WordBits;
+    unsigned long x = words[w] >> o;
+    if (o + len > WordBits) x |= words[w + 1] << (WordBits - o);
+    return len == WordBits ? x : x & ((1ul << len) - 1);
+  }
+
+  // Ors len bits of src from src_pos into dst from dst_pos.
+  static void copyBits(unsigned long* dst, size_t dst_pos,
+                       const unsigned long* src, size_t src_pos, size_t len) {
+    for (size_t i = 0; i < len; i += WordBits) {
+      int n = std::min<size_t>(WordBits, len - i);
+      unsigned long x = getBits(src, src_pos + i, n);
+      size_t p = dst_pos + i;
+      int o = p % WordBits;
+      dst[p / WordBits] |= x << o;
+      if (o + n > WordBits) dst[p / WordBits + 1] |= x >> (WordBits - o);
+    }
+  }
+
+  static void leafInsert(Leaf* leaf, size_t pos, bool bit) {
+    assert(leaf->size < LeafBits);
+    const size_t w = pos / WordBits;
+    const unsigned long low = (1ul << (pos % WordBits)) - 1;
+    for (size_t i = leaf->size / WordBits; i > w; --i) {
+      leaf->words[i] = (leaf->words[i] << 1) | (leaf->words[i - 1] >> 63);
+    }
+    unsigned long x = leaf->words[w];
+    leaf->words[w] = ((x & ~low) << 1) | (x & low) |
+                     (unsigned long)bit << (pos % WordBits);
+    leaf->size++;
+    leaf->ones += bit;
+  }
+
+  static bool leafErase(Leaf* leaf, size_t pos) {
+    const size_t w = pos / WordBits;
+    const unsigned long low = (1ul << (pos % WordBits)) - 1;
+    unsigned long x = leaf->words[w];
+    bool bit = (x >> (pos % WordBits)) & 1;
+    leaf->words[w] = (x & low) | ((x >> 1) & ~low);
+    const size_t last = (leaf->size - 1) / WordBits;
+    for (size_t i = w; i < last; ++i) {
+      leaf->words[i] |= leaf->words[i + 1] << 63;
+      leaf->words[i + 1] >>= 1;
+    }
+    leaf->size--;
+    leaf->ones -= bit;
+    return bit;
+  }
+
+  // Sets leaf to bits [pos, pos + len) of words.
+  static void fillLeaf(Leaf* leaf, const unsigned long* words, size_t pos,
+                       size_t len) {
+    memset(leaf->words, 0, sizeof(leaf->words));
+    copyBits(leaf->words, 0, words, pos, len);
+    leaf->size = len;
+    leaf->ones = len == 0 ? 0 : PrefixPopcount(leaf->words, len);
+  }
+
+  // Moves the contents of siblings a and b into a if they fit in one node,
+  // and otherwise shares them evenly. Returns whether b is still used.
+  bool rebalance(void* a, void* b, int d) {
+    if (d == height_) {
+      Leaf* la = static_cast<Leaf*>(a);
+      Leaf* lb = static_cast<Leaf*>(b);
+      unsigned long tmp[2 * LeafWords] = {};
+      copyBits(tmp, 0, la->words, 0, la->size);
+      copyBits(tmp, la->size, lb->words, 0, lb->size);
+      const size_t total = la->size + lb->size;
+      const size_t left = total < LeafBits ? total : total / 2;
+      fillLeaf(la, tmp, 0, left);
+      fillLeaf(lb, tmp, left, total - left);
+      return total >= LeafBits;
+    }
+    Inner* ia = static_cast<Inner*>(a);
+    Inner* ib = static_cast<Inner*>(b);
+    const int total = ia->n + ib->n;
+    const int left = total < Fanout ? total : total / 2;
+    if (left >= ia->n) {
+      // Move the first left - ia->n children of b to a.
+      const int moved = left - ia->n;
+      std::copy(ib->size, ib->size + moved, ia->size + ia->n);
+      std::copy(ib->ones, ib->ones + moved, ia->ones + ia->n);
+      std::copy(ib->child, ib->child + moved, ia->child + ia->n);
+      std::copy(ib->size + moved, ib->size + ib->n, ib->size);
+      std::copy(ib->ones + moved, ib->ones + ib->n, ib->ones);
+      std::copy(ib->child + moved, ib->child + ib->n, ib->child);
+    } else {
+      // Move the last ia->n - left children of a to the front of b.
+      const int moved = ia->n - left;
+      std::copy_backward(ib->size, ib->size + ib->n,
+                         ib->size + ib->n + moved);
+      std::copy_backward(ib->ones, ib->ones + ib->n,
+                         ib->ones + ib->n + moved);
+      std::copy_backward(ib->child, ib->child + ib->n,
+                         ib->child + ib->n + moved);
+      std::copy(ia->size + left, ia->size + ia->n, ib->size);
+      std::copy(ia->ones + left, ia->ones + ia->n, ib->ones);
+      std::copy(ia->child + left, ia->child + ia->n, ib->child);
+    }
+    ia->n = left;
+    ib->n = total - left;
+    return ib->n != 0;
+  }
+
+  // Inserts bit at pos below node at depth d. Returns the new right
+  // sibling of node if it was split, nullptr otherwise.
+  void* insert(void* node, int d, size_t pos, bool bit) {
+    if (d == height_) {
+      Leaf* leaf = static_cast<Leaf*>(node);
+      leafInsert(leaf, pos, bit);
+      if (leaf->size < LeafBits) return nullptr;
+      Leaf* right = newLeaf();
+      rebalance(leaf, right, d);
+      return right;
+    }
+    Inner* in = static_cast<Inner*>(node);
+    int i = 0;
+    while (i + 1 < in->n && pos > in->size[i]) {
+      pos -= in->size[i];
+      ++i;
+    }
+    in->size[i]++;
+    in->ones[i] += bit;
+    void* split = insert(in->child[i], d + 1, pos, bit);
+    if (split == nullptr) return nullptr;
+    std::copy_backward(in->size + i + 1, in->size + in->n,
+                       in->size + in->n + 1);
+    std::copy_backward(in->ones + i + 1, in->ones + in->n,
+                       in->ones + in->n + 1);
+    std::copy_backward(in->child + i + 1, in->child + in->n,
+                       in->child + in->n + 1);
+    in->child[i + 1] = split;
+    in->n++;
+    totals(in->child[i], d + 1, &in->size[i], &in->ones[i]);
+    totals(split, d + 1, &in->size[i + 1], &in->ones[i + 1]);
+    if (in->n < Fanout) return nullptr;
+    Inner* right = new Inner();
+    rebalance(in, right, d);
+    return right;
+  }
+
+  // Removes the bit at pos below node at depth d and returns it.
+  bool erase(void* node, int d, size_t pos) {
+    if (d == height_) {
+      return leafErase(static_cast<Leaf*>(node), pos);
+    }
+    Inner* in = static_cast<Inner*>(node);
+    int i = 0;
+    while (pos >= in->size[i]) {
+      pos -= in->size[i];
+      ++i;
+    }
+    bool bit = erase(in->child[i], d + 1, pos);
+    in->size[i]--;
+    in->ones[i] -= bit;
+    if (in->n > 1 && underfull(in->child[i], d + 1)) {
+      // Rebalance children j and j + 1.
+      const int j = i + 1 < in->n ? i : i - 1;
+      if (rebalance(in->child[j], in->child[j + 1], d + 1)) {
+        totals(in->child[j + 1], d + 1, &in->size[j + 1], &in->ones[j + 1]);
+      } else {
+        destroy(in->child[j + 1], d + 1);
+        std::copy(in->size + j + 2, in->size + in->n, in->size + j + 1);
+        std::copy(in->ones + j + 2, in->ones + in->n, in->ones + j + 1);
+        std::copy(in->child + j + 2, in->child + in->n, in->child + j + 1);
+        in->n--;
+      }
+      totals(in->child[j], d + 1, &in->size[j], &in->ones[j]);
+    }
+    return bit;
+  }
+
+  // Builds the tree bottom up from leaves and nodes three quarters full,
+  // which leaves room for inserts before the first splits.
+  void build(const std::vector<bool>& vec) {
+    std::vector<void*> nodes;
+    const size_t leaf_fill = LeafBits / 4 * 3;
+    for (size_t start = 0; start < vec.size() || nodes.empty();) {
+      size_t end = std::min(vec.size(), start + leaf_fill);
+      // A short last leaf is joined to the previous one.
+      if (vec.size() - end < LeafBits / 4) end = vec.size();
+      Leaf* leaf = newLeaf();
+      for (size_t i = start; i < end; ++i) {
+        leaf->words[(i - start) / WordBits] |=
+            (unsigned long)vec[i] << ((i - start) % WordBits);
+      }
+      leaf->size = end - start;
+      leaf->ones = leaf->size == 0 ? 0 :
+                   PrefixPopcount(leaf->words, leaf->size);
+      ones_ += leaf->ones;
+      nodes.push_back(leaf);
+      start = end;
+    }
+    destroy(root_, 0);
+    const int node_fill = Fanout / 4 * 3;
+    // With height_ the height of nodes, totals() sees them at depth 0.
+    for (height_ = 0; nodes.size() > 1; ++height_) {
+      std::vector<void*> parents;
+      for (size_t start = 0; start < nodes.size();) {
+        size_t end = std::min(nodes.size(), start + node_fill);
+        if (nodes.size() - end < size_t(Fanout / 4)) end = nodes.size();
+        Inner* in = new Inner();
+        in->n = end - start;
+        for (size_t i = start; i < end; ++i) {
+          in->child[i - start] = nodes[i];
+          totals(nodes[i], 0, &in->size[i - start], &in->ones[i - start]);
+        }
+        parents.push_back(in);
+        start = end;
+      }
+      nodes.swap(parents);
+    }
+    root_ = nodes[0];
+    size_ = vec.size();
+  }
+
+  void* root_;
+  // Depth of the leaves, 0 if the root is a leaf.
+  int height_;
+  size_t size_;
+  size_t ones_;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef DYNAMIC_WAVELET_H
+#define DYNAMIC_WAVELET_H
+
+#include "dynamic-bit-vector.h"
+#include <stdint.h>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+
+// Wavelet matrix over dynamic bit vectors, supporting insert, erase and
+// set of values at any position in O(log n log sigma) alongside the
+// queries of BalancedWavelet. A value has one bit on every level at the
+// position it moves to as in WaveletMatrix, so an update inserts or
+// removes one bit per level, with no node boundaries to maintain.
+// The number of bits per value is fixed at construction, and inserted
+// values must fit in it.
+template<typename BitVector = DynamicBitVector>
+class DynamicWavelet {
+ public:
+  // Empty sequence of values < 2^bits.
+  explicit DynamicWavelet(int bits)
+      : levels_(bits),
+        zeros_(bits, 0),
+        size_(0),
+        bits_(bits) {
+    assert(bits >= 1 && bits <= MaxBits);
+  }
+
+  // Values < 2^bits, or bits = 0 for just enough bits for the largest
+  // value.
+  template<typename It>
+  DynamicWavelet(It begin, It end, int bits = 0)
+      : size_(0),
+        bits_(bits) {
+    std::vector<uint64_t> vec(begin, end);
+    size_ = vec.size();
+    if (bits_ == 0) {
+      uint64_t max = vec.empty() ? 0 : *std::max_element(vec.begin(),
+                                                         vec.end());
+      bits_ = max == 0 ? 1 : 64 - __builtin_clzll(max);
+    }
+    assert(bits_ >= 1 && bits_ <= MaxBits);
+    levels_.reserve(bits_);
+    std::vector<bool> level(size_);
+    for (int l = 0; l < bits_; ++l) {
+      uint64_t bit = 1ull << (bits_ - l - 1);
+      size_t zeros = 0;
+      for (size_t i = 0; i < size_; ++i) {
+        assert(inRange(vec[i]));
+        level[i] = (vec[i] & bit) != 0;
+        zeros += !level[i];
+      }
+      levels_.emplace_back(level);
+      zeros_.push_back(zeros);
+      std::stable_partition(vec.begin(), vec.end(), [&](uint64_t x) -> bool {
+        return (x & bit) == 0;
+      });
+    }
+  }
+
+  DynamicWavelet(const DynamicWavelet& o) = delete;
+
+  DynamicWavelet(DynamicWavelet&& o)
+      : levels_(std::move(o.levels_)),
+        zeros_(std::move(o.zeros_)),
+        size_(o.size_),
+        bits_(o.bits_) {
+    o.size_ = 0;
+  }
+
+  const DynamicWavelet& operator=(DynamicWavelet&& o) {
+    levels_ = std::move(o.levels_);
+    zeros_ = std::move(o.zeros_);
+    size_ = o.size_;
+    bits_ = o.bits_;
+    o.size_ = 0;
+    return *this;
+  }
+
+  // Inserts value before position pos, pos == size() appends.
+  void insert(size_t pos, uint64_t value) {
+    assert(pos <= size_);
+    assert(inRange(value));
+    for (int l = 0; l < bits_; ++l) {
+      bool bit = (value >> (bits_ - l - 1)) & 1;
+      levels_[l].insert(pos, bit);
+      zeros_[l] += !bit;
+      // Bits before pos are unchanged, so this is where the value went.
+      pos = down(l, pos, bit);
+    }
+    ++size_;
+  }
+
+  // Removes the value at pos and returns it.
+  uint64_t erase(size_t pos) {
+    assert(pos < size_);
+    uint64_t value = 0;
+    for (int l = 0; l < bits_; ++l) {
+      size_t r;
+      bool bit = levels_[l].accessRank(pos, &r);
+      size_t next = bit ? zeros_[l] + r : r;
+      levels_[l].erase(pos);
+      zeros_[l] -= !bit;
+      value = (value << 1) | bit;
+      pos = next;
+    }
+    --size_;
+    return value;
+  }
+
+  // Replaces the value at pos. The old value's bits are removed and the
+  // new ones inserted, as they need not be at the same position on the
+  // levels below the first differing bit.
+  void set(size_t pos, uint64_t value) {
+    erase(pos);
+    insert(pos, value);
+  }
+
+  size_t rank(size_t pos, uint64_t value) const {
+    assert(pos <= size());
+    if (!inRange(value)) return 0;
+    size_t begin = 0;
+    for (int l = 0; l < bits_; ++l) {
+      bool bit = (value >> (bits_ - l - 1)) & 1;
+      begin = down(l, begin, bit);
+      pos = down(l, pos, bit);
+    }
+    return pos - begin;
+  }
+
+  size_t rankLE(size_t pos, uint64_t value) const {
+    assert(pos <= size());
+    if (!inRange(value)) return pos;
+    size_t ret = 0;
+    size_t begin = 0;
+    for (int l = 0; l < bits_; ++l) {
+      bool bit = (value >> (bits_ - l - 1)) & 1;
+      size_t nbegin = down(l, begin, bit);
+      size_t npos = down(l, pos, bit);
+      if (bit) {
+        // Values with a zero here are smaller.
+        ret += (pos - begin) - (npos - nbegin);
+      }
+      begin = nbegin;
+      pos = npos;
+    }
+    return ret + pos - begin;
+  }
+
+  uint64_t operator[](size_t i) const {
+    uint64_t value = 0;
+    for (int l = 0; l < bits_; ++l) {
+      size_t r;
+      bool bit = levels_[l].accessRank(i, &r);
+      i = bit ? zeros_[l] + r : r;
+      value = (value << 1) | bit;
+    }
+    return value;
+  }
+
+  // Returns smallest position pos so that rank(pos, value) == rank.
+  size_t select(size_t rank, uint64_t value) const {
+    if (rank == 0 || size_ == 0) return 0;
+    if (!inRange(value)) return 0;
+    // Start of the node of value on each level.
+    size_t begin[MaxBits + 1];
+    begin[0] = 0;
+    for (int l = 0; l < bits_; ++l) {
+      bool bit = (value >> (bits_ - l - 1)) & 1;
+      begin[l + 1] = down(l, begin[l], bit);
+    }
+    // Walk up from the rank:th occurrence on the last level.
+    size_t pos = begin[bits_] + rank;
+    for (int l = bits_ - 1; l >= 0; --l) {
+      bool bit = (value >> (bits_ - l - 1)) & 1;
+      size_t idx = bit ? pos - zeros_[l] : pos;
+      pos = levels_[l].select(idx, bit);
+    }
+    return pos;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  int bits() const {
+    return bits_;
+  }
+  size_t bitSize() const {
+    size_t ret = sizeof(*this) * 8 + zeros_.size() * 64;
+    for (size_t l = 0; l < levels_.size(); ++l) {
+      ret += levels_[l].bitSize();
+    }
+    return ret;
+  }
+
+ private:
+  static const int MaxBits = 64;
+  bool inRange(uint64_t value) const {
+    return bits_ == MaxBits || value >> bits_ == 0;
+  }
+  // Position of pos on level l + 1 when following bit.
+  size_t down(int l, size_t pos, bool bit) const {
+    size_t r = levels_[l].rank(pos, bit);
+    return bit ? zeros_[l] + r : r;
+  }
+
+  std::vector<BitVector> levels_;
+  // Number of zeros on each level.
+  std::vector<size_t> zeros_;
+  size_t size_;
+  int bits_;
+};
+
+#endif
@@ -1,148 +1,57 @@
 #include "fast-bit-vector.h"
 
-#include <cassert>
-#include <cstring>
-#include <cstdint>
-
-
-FastBitVector::FastBitVector() {
-  size_ = 0;
-  popcount_ = 0;
-  bits_ = nullptr;
-  rank_samples_ = nullptr;
-  select_samples_[0] = nullptr;
-  select_samples_[1] = nullptr;
-}
-
-FastBitVector::FastBitVector(const std::vector<bool>& data) {
-  size_ = data.size();
-  const size_t word_count = 1 + size_ / WordBits;
-  bits_ = new unsigned long[word_count];
-  memset(bits_, 0, word_count * sizeof(long));
-  // Init bits.
-  popcount_ = 0;
-  for (size_t i = 0; i < data.size(); ++i) {
-    popcount_ += data[i];
-    long p = i / WordBits;
-    long o = i % WordBits;
-    bits_[p] |= long(data[i]) << o;
-  }
-
-  // Init rank samples.
-  rank_samples_ = new RankBlock[2 + size_ / RankSample];
-  rank_samples_[0].abs = 0;
-  size_t sum = 0;
-  for (size_t i = 0; i <= size_/RankSample; i++) {
-    uint64_t sub_block[6] = {};
-    for (size_t j = 0; j < RankSample; ++j) {
-      size_t idx = i * RankSample + j;
-      if (idx >= data.size()) break;
-      sum += data[idx];
-      sub_block[j / RankSubSample] += data[idx];
-    }
-    for (int j = 1; j < 6; ++j) {
-      sub_block[j] += sub_block[j-1];
-    }
-    // Put in reverse order to remove branch for sub_block = 0
-    rank_samples_[i].rel = 
-        (sub_block[0] << 44) + 
-        (sub_block[1] << 33) + 
-        (sub_block[2] << 22) + 
-        (sub_block[3] << 11) + 
-        (sub_block[4] << 00);
-    rank_samples_[1 + i].abs = sum;
-  }
-
-  // Init select samples.
-  select_samples_[1] = new uint32_t[2 + popcount_ / SelectSample];
-  select_samples_[0] = new uint32_t[2 + (size_ - popcount_) / SelectSample];
-  size_t sums[2] = {0, 0};
-  size_t idx[2] = {1, 1};
-  select_samples_[0][0] = select_samples_[1][0] = 0;
-  for (size_t i = 0; i < size_; i++) {
-    int bit = data[i];
-    sums[bit]++;
-    if (sums[bit] % SelectSample == 0) {
-      size_t id = idx[bit]++;
-      size_t rs = i / RankSample;
-      select_samples_[bit][id] = rs;
-      if (bit)
-        assert(rank_samples_[rs].abs <= id * SelectSample);
-#if 0
-      size_t pos = i + 1;
-      size_t word = pos / WordBits;
-      // Set to point to the word.
-      select_samples_[bit][id] = word * WordBits;
-      // Correction info: how many bits are set afterwards.
-      unsigned long wmask = (1L << (pos % WordBits)) - 1L;
-      unsigned long counted = bit ? wmask & bits_[word] :
-          (wmask & ~bits_[word]);
-      select_samples_[bit][id] |= __builtin_popcountll(counted);
-#endif
-    }
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool WriteSections(const char* path, const void* const* data,
+                   const size_t* bytes, int n) {
+  FILE* f = fopen(path, "wb");
+  if (f == nullptr) return false;
+  bool ok = true;
+  for (int i = 0; i < n && ok; ++i) {
+    if (bytes[i] == 0) continue;
+    ok = fwrite(data[i], bytes[i], 1, f) == 1 && WritePadding(f, bytes[i]);
   }
-  select_samples_[0][idx[0]] = 1 + (size_ / RankSample);
-  select_samples_[1][idx[1]] = 1 + (size_ / RankSample);
+  return fclose(f) == 0 && ok;
 }
 
-FastBitVector::FastBitVector(FastBitVector&& other) 
-    : size_(0),
-      popcount_(0),
-      bits_(nullptr),
-      rank_samples_(nullptr),
-      select_samples_{nullptr,nullptr} {
-  swap(*this, other);
+bool WritePadding(FILE* f, size_t bytes) {
+  static const char zeros[64] = {};
+  size_t pad = (64 - bytes % 64) % 64;
+  return pad == 0 || fwrite(zeros, pad, 1, f) == 1;
 }
 
-const FastBitVector& FastBitVector::operator=(FastBitVector&& other) {
-  swap(*this, other);
-  return *this;
-}
-
-#if 0
-// Number of positions < pos set with bit_value.
-size_t FastBitVector::rank(size_t pos, bool bit_value) const {
-  rank_count++;
-  assert(pos <= size_);
-  size_t block = pos / RankSample;
-  size_t sum = rank_samples_[block];
-
-  size_t word;
-  for (word = block * RankSample / WordBits;
-       (word + 1) * WordBits <= pos;
-       ++word) {
-    sum += __builtin_popcountll(bits_[word]);
+bool CopySection(FILE* from, FILE* f, size_t bytes) {
+  char buf[1 << 16];
+  for (size_t done = 0; done < bytes;) {
+    size_t n = std::min(sizeof(buf), bytes - done);
+    if (fread(buf, n, 1, from) != 1 || fwrite(buf, n, 1, f) != 1) {
+      return false;
+    }
+    done += n;
   }
-  size_t first_bits = pos - word * WordBits;
-  // Add first bits from the last word.
-  unsigned long mask = (1LL << first_bits) - 1LL;
-  sum += __builtin_popcountll(bits_[word] & mask);
-  if (bit_value == 0) return pos - sum;
-  return sum;
+  return WritePadding(f, bytes);
 }
-#endif
-
-// Returns smallest position pos so that rank(pos,bit) == idx
 
-size_t FastBitVector::extra_bits() const {
-  size_t r = 1 + popcount_ / SelectSample;
-  r += 2 + (size_ - popcount_) / SelectSample;
-  r += 2 + size_ / RankSample;
-  return r * WordBits + sizeof(FastBitVector) * 8;
+void* MapFile(const char* path, size_t* length) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+  *length = st.st_size;
+  void* map = mmap(nullptr, *length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return nullptr;
+  return map;
 }
 
-FastBitVector::~FastBitVector() {
-  delete[] rank_samples_;
-  delete[] select_samples_[0];
-  delete[] select_samples_[1];
-  delete[] bits_;
-}
-void swap(FastBitVector& a, FastBitVector& b) {
-  using std::swap;
-  swap(a.size_, b.size_);
-  swap(a.popcount_, b.popcount_);
-  swap(a.bits_, b.bits_);
-  swap(a.rank_samples_, b.rank_samples_);
-  swap(a.select_samples_[0], b.select_samples_[0]);
-  swap(a.select_samples_[1], b.select_samples_[1]);
+void UnmapFile(void* map, size_t length) {
+  munmap(map, length);
 }
@@ -4,29 +4,121 @@
 // Supports select and rank queries.
 
 #include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <vector>
 #include <cassert>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <type_traits>
 #include <stdint.h>
 
 #include "bit-utils.h"
 
 using std::size_t;
 
+// Sampling policy of BasicFastBitVector, all sizes in bits.
+//  RankSampleBits:    absolute rank is stored once per rank block.
+//  RankSubSampleBits: ranks relative to the block start are stored per
+//                     sub-block, packed in one word. Set equal to
+//                     RankSampleBits to store no relative ranks.
+//  SelectSampleBits:  the rank block of every SelectSampleBits:th bit value
+//                     is stored. 0 stores nothing and select binary searches
+//                     all rank blocks.
+// The packing of relative ranks is derived from these at compile time.
+template<unsigned RankSampleBits,
+         unsigned RankSubSampleBits,
+         unsigned SelectSampleBits>
+struct Sampling {
+  static const unsigned RankSample = RankSampleBits;
+  static const unsigned RankSubSample = RankSubSampleBits;
+  static const unsigned SelectSample = SelectSampleBits;
+};
+
+// Rank in O(1) with at most 6 popcounts, sampled select.
+typedef Sampling<2048, 384, 4096> DefaultSampling;
+// For rank only workloads: no select samples.
+typedef Sampling<2048, 384, 0> RankOnlySampling;
+// For select only workloads: the rank directory keeps only the absolute
+// ranks select needs, rank scans up to a whole block.
+typedef Sampling<2048, 2048, 4096> SelectOnlySampling;
+// Finer sampling for latency sensitive workloads.
+typedef Sampling<512, 128, 1024> FineSampling;
+
+// File helpers for save() and views, implemented in fast-bit-vector.cpp.
+// Writes n sections to path, each padded to a multiple of 64 bytes.
+bool WriteSections(const char* path, const void* const* data,
+                   const size_t* bytes, int n);
+// Writes zeros to f to pad a section of bytes bytes to a multiple of 64.
+bool WritePadding(FILE* f, size_t bytes);
+// Copies bytes bytes from the current position of from to f, then pads.
+bool CopySection(FILE* from, FILE* f, size_t bytes);
+// Maps path read-only. Returns nullptr on failure.
+void* MapFile(const char* path, size_t* length);
+void UnmapFile(void* map, size_t length);
+
+// On-disk layout written by save and mapped by BasicFastBitVectorView.
+// All integers are native endian, every section starts at a multiple of
+// 64 bytes.
+//   Header (64 bytes): uint64_t magic, size, popcount, word_count,
+//                      rank_count, select_count[2], sampling.
+//   bits_:              word_count 64-bit words.
+//   rank_samples_:      rank_count rank blocks of RankWords uint64_t:
+//                       absolute rank, then packed relative ranks if any.
+//   select_samples_[0]: select_count[0] uint32_t.
+//   select_samples_[1]: select_count[1] uint32_t.
+
+template<typename Policy>
+class BasicFastBitVectorView;
 
-class FastBitVector {
-  // These two CANNOT be modified.
-  static const unsigned RankSample = 2048;
-  static const unsigned RankSubSample = 384;
-  // This CAN be tweaked.
-  static const unsigned SelectSample = 2 * 2048;
+template<typename Policy = DefaultSampling>
+class BasicFastBitVector {
+  static const unsigned RankSample = Policy::RankSample;
+  static const unsigned RankSubSample = Policy::RankSubSample;
+  static const unsigned SelectSample = Policy::SelectSample;
   static const unsigned WordBits = 8 * sizeof(long);
+  static const unsigned SubBlocks =
+      (RankSample + RankSubSample - 1) / RankSubSample;
+  // Bits per packed relative rank.
+  static const unsigned RelBits = BitWidth((SubBlocks - 1) * RankSubSample);
+  // Words per rank block: absolute rank and packed relative ranks.
+  static const unsigned RankWords = SubBlocks > 1 ? 2 : 1;
+  static const bool HasSelectSamples = SelectSample != 0;
+  static_assert(RankSample % WordBits == 0 && RankSubSample % WordBits == 0,
+                "Samples must be whole words");
+  static_assert(RankSubSample <= RankSample,
+                "Sub-blocks can not be larger than blocks");
+  // Strictly less, so that sub-block 0 shifts everything out.
+  static_assert((SubBlocks - 1) * RelBits < 64,
+                "Relative ranks must fit in one word");
+  // Rank blocks per thread needed before construction is parallelized.
+  static const unsigned MinThreadBlocks = 4096;
+  // How many queries ahead batch operations prefetch.
+  static const unsigned PrefetchDistance = 16;
  public:
   // Empty constructor.
-  FastBitVector();
-  explicit FastBitVector(const std::vector<bool>& data);
-  FastBitVector(const FastBitVector& other) = delete;
-  FastBitVector(FastBitVector&& other);
-  const FastBitVector& operator=(FastBitVector&& other);
+  BasicFastBitVector()
+      : size_(0),
+        popcount_(0),
+        bits_(nullptr),
+        rank_samples_(nullptr),
+        select_samples_{nullptr, nullptr},
+        mapping_(nullptr),
+        mapping_size_(0) { }
+  explicit BasicFastBitVector(const std::vector<bool>& data);
+  // Copies size bits from packed words, bit i is (words[i / 64] >> i % 64) & 1.
+  BasicFastBitVector(const unsigned long* words, size_t size);
+  // Takes ownership of packed words, which must hold 1 + size / 64 words.
+  BasicFastBitVector(std::unique_ptr<unsigned long[]> words, size_t size);
+  BasicFastBitVector(const BasicFastBitVector& other) = delete;
+  BasicFastBitVector(BasicFastBitVector&& other) : BasicFastBitVector() {
+    swap(*this, other);
+  }
+  const BasicFastBitVector& operator=(BasicFastBitVector&& other) {
+    swap(*this, other);
+    return *this;
+  }
 
   bool operator[](size_t pos) const {
     size_t i = pos / WordBits;
@@ -39,35 +131,49 @@ class FastBitVector {
     if (pos == 0) return 0;
     size_t block = pos / RankSample;
     unsigned remaining = pos % RankSample;
-    size_t sum = rank_samples_[block].abs;
+    size_t sum = rankAbs(block);
     int sub_block = remaining / RankSubSample;
     sum += subBlockRank(block, sub_block);
     remaining -= RankSubSample * sub_block;
     size_t word = (block * RankSample + sub_block * RankSubSample) / WordBits;
-    size_t end_word = pos / WordBits;
-    for (; word < end_word; ++word) {
-      sum += __builtin_popcountll(bits_[word]);
-      remaining -= WordBits;
-    }
-    // Add first bits from the last word.
-    unsigned long mask = (1LL << remaining) - 1LL;
-    sum += __builtin_popcountll(bits_[word] & mask);
+    // Count the remaining bits of the sub-block.
+    sum += PrefixPopcount(&bits_[word], remaining);
     if (bit_value == 0) return pos - sum;
     return sum;
   }
 
+  // Returns the bit at pos and sets *rank = rank(pos, bit).
+  // Same lookup as rank, but the word of pos is loaded once for both its
+  // prefix count and the bit.
+  bool accessRank(size_t pos, size_t* rank) const {
+    size_t block = pos / RankSample;
+    unsigned remaining = pos % RankSample;
+    size_t sum = rankAbs(block);
+    int sub_block = remaining / RankSubSample;
+    sum += subBlockRank(block, sub_block);
+    remaining -= RankSubSample * sub_block;
+    size_t word = (block * RankSample + sub_block * RankSubSample) / WordBits;
+    unsigned offset = remaining % WordBits;
+    // Whole words of the sub-block before the word of pos.
+    sum += PrefixPopcount(&bits_[word], remaining - offset);
+    unsigned long w = bits_[pos / WordBits];
+    sum += __builtin_popcountl(w & ((1ul << offset) - 1));
+    bool bit = (w >> offset) & 1;
+    *rank = bit ? sum : pos - sum;
+    return bit;
+  }
+
   // Returns smallest position pos so that rank(pos,bit) == idx
   size_t select(size_t idx, bool bit) const {
     if (idx == 0) return 0;
     assert(idx <= count(bit));
     // Start from sampling.
-    size_t block = idx / SelectSample;
-    size_t left = select_samples_[bit][block];
-    size_t right = select_samples_[bit][block + 1];
+    size_t left, right;
+    selectRange(idx, bit, &left, &right);
     // Binary search correct rank-sample
     while (left + 1 < right) {
       size_t c = (left + right) / 2;
-      size_t r = bit ? rank_samples_[c].abs : c * RankSample - rank_samples_[c].abs;
+      size_t r = bit ? rankAbs(c) : c * RankSample - rankAbs(c);
       if (r >= idx) {
         right = c;
       } else {
@@ -75,11 +181,11 @@ class FastBitVector {
       }
     }
     size_t word_start = left * RankSample / WordBits;
-    size_t word_rank = bit ? rank_samples_[left].abs : left * RankSample - rank_samples_[left].abs;
+    size_t word_rank = bit ? rankAbs(left) : left * RankSample - rankAbs(left);
     assert(word_rank <= idx);
     // Linear search for correct rank-sub-sample
     const size_t total_words = (size_ + WordBits - 1) / WordBits;
-    for (int sub_block = 5; sub_block > 0; --sub_block) {
+    for (int sub_block = SubBlocks - 1; sub_block > 0; --sub_block) {
       size_t r = subBlockRank(left, sub_block);
       r = bit ? r : (sub_block * RankSubSample - r);
       if (r + word_rank < idx) {
@@ -94,13 +200,10 @@ class FastBitVector {
     assert(word_rank <= idx);
 
     // Scan words
-    for (size_t w = word_start; w < total_words; ++w) {
-      size_t pop = __builtin_popcountll(bits_[w]);
-      size_t r = word_rank + (bit ? pop : WordBits - pop);
-      if (r >= idx) break;
-      word_rank = r;
-      word_start = w + 1;
-    }
+    size_t before;
+    word_start += WordScan(&bits_[word_start], total_words - word_start,
+                           idx - word_rank, bit, &before);
+    word_rank += before;
 
     // Scan bits
     size_t id = idx - word_rank;
@@ -111,6 +214,44 @@ class FastBitVector {
     return word_start * WordBits + WordSelect(w, id);
   }
 
+  // Batched rank: out[i] = rank(pos[i], bit) for i < n.
+  // Cache lines of later queries are prefetched while answering the current
+  // one, so independent queries overlap their memory latency.
+  void rankBatch(const size_t* pos, bool bit, size_t* out, size_t n) const {
+    size_t ahead = std::min<size_t>(n, PrefetchDistance);
+    for (size_t i = 0; i < ahead; ++i) {
+      prefetchRank(pos[i]);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (i + PrefetchDistance < n) {
+        prefetchRank(pos[i + PrefetchDistance]);
+      }
+      out[i] = rank(pos[i], bit);
+    }
+  }
+
+  // Batched select: out[i] = select(idx[i], bit) for i < n.
+  // Runs in two stages: select samples are prefetched 2 * PrefetchDistance
+  // queries ahead, and the rank samples they point to PrefetchDistance ahead.
+  void selectBatch(const size_t* idx, bool bit, size_t* out, size_t n) const {
+    const size_t far = 2 * PrefetchDistance;
+    for (size_t i = 0; i < std::min<size_t>(n, far); ++i) {
+      prefetchSelectSample(idx[i], bit);
+    }
+    for (size_t i = 0; i < std::min<size_t>(n, PrefetchDistance); ++i) {
+      prefetchSelectRank(idx[i], bit);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (i + far < n) {
+        prefetchSelectSample(idx[i + far], bit);
+      }
+      if (i + PrefetchDistance < n) {
+        prefetchSelectRank(idx[i + PrefetchDistance], bit);
+      }
+      out[i] = select(idx[i], bit);
+    }
+  }
+
   size_t size() const {
     return size_;
   }
@@ -118,31 +259,541 @@ class FastBitVector {
     if (bit) return popcount_;
     return size() - popcount_;
   }
-  size_t extra_bits() const;
+  // Packed bits, bit i is (data()[i / 64] >> i % 64) & 1.
+  const unsigned long* data() const {
+    return bits_;
+  }
+  // Bits used besides size(): word padding, samples and the object itself.
+  size_t extra_bits() const {
+    FileHeader h = fileHeader();
+    size_t r = h.word_count * WordBits - size_;
+    r += h.rank_count * RankWords * 64;
+    r += (h.select_count[0] + h.select_count[1]) * 32;
+    return r + sizeof(*this) * 8;
+  }
   size_t bitSize() const {
     return size() + extra_bits();
   }
 
-  ~FastBitVector();
-  friend void swap(FastBitVector& a, FastBitVector& b);
+  // Writes the vector to path in the on-disk layout. If header_bytes > 0,
+  // header is written first and the vector starts at the next multiple of
+  // 64 bytes. Returns false on I/O error.
+  bool save(const char* path, const void* header = nullptr,
+            size_t header_bytes = 0) const {
+    FileHeader h = fileHeader();
+    const void* data[6] = {
+      header, &h, bits_, rank_samples_, select_samples_[0], select_samples_[1]
+    };
+    size_t bytes[6] = {
+      header_bytes,
+      sizeof(h),
+      h.word_count * sizeof(long),
+      h.rank_count * RankWords * sizeof(uint64_t),
+      h.select_count[0] * sizeof(uint32_t),
+      h.select_count[1] * sizeof(uint32_t),
+    };
+    return WriteSections(path, data, bytes, 6);
+  }
+
+  // Writes the file save would write for the size bits in words, which
+  // holds 1 + size / 64 words from its current position. Reads words once
+  // and writes path sequentially, buffering at most about memory_limit
+  // bytes. Returns false on I/O error.
+  static bool SaveFromFile(FILE* words, size_t size, const char* path,
+                           const void* header, size_t header_bytes,
+                           size_t memory_limit);
+
+  ~BasicFastBitVector() {
+    if (mapping_ != nullptr) {
+      UnmapFile(mapping_, mapping_size_);
+      return;
+    }
+    delete[] rank_samples_;
+    delete[] select_samples_[0];
+    delete[] select_samples_[1];
+    delete[] bits_;
+  }
+
+  friend void swap(BasicFastBitVector& a, BasicFastBitVector& b) {
+    using std::swap;
+    swap(a.size_, b.size_);
+    swap(a.popcount_, b.popcount_);
+    swap(a.bits_, b.bits_);
+    swap(a.rank_samples_, b.rank_samples_);
+    swap(a.select_samples_[0], b.select_samples_[0]);
+    swap(a.select_samples_[1], b.select_samples_[1]);
+    swap(a.mapping_, b.mapping_);
+    swap(a.mapping_size_, b.mapping_size_);
+  }
+
  private:
+  template<typename P>
+  friend class BasicFastBitVectorView;
+  static const uint64_t FileMagic = 0x3176626674736166ull;  // "fastbfv1"
+  struct FileHeader {
+    uint64_t magic;
+    uint64_t size;
+    uint64_t popcount;
+    uint64_t word_count;
+    uint64_t rank_count;
+    uint64_t select_count[2];
+    // Sampling policy, files only map into vectors with the same policy.
+    uint64_t sampling;
+  };
+  // Whether the section counts of h are the ones fileHeader and
+  // SaveFromFile derive from its size and popcount.
+  static bool ValidFileHeader(const FileHeader& h) {
+    if (h.popcount > h.size) return false;
+    if (h.word_count == 0) {
+      // A default constructed vector has no sections.
+      return h.size == 0 && h.rank_count == 0 &&
+             h.select_count[0] == 0 && h.select_count[1] == 0;
+    }
+    uint64_t select0 = 0, select1 = 0;
+    if (HasSelectSamples) {
+      select0 = 2 + (h.size - h.popcount) / selectStep();
+      select1 = 2 + h.popcount / selectStep();
+    }
+    return h.word_count == 1 + h.size / WordBits &&
+           h.rank_count == 2 + h.size / RankSample &&
+           h.select_count[0] == select0 && h.select_count[1] == select1;
+  }
+  static uint64_t SamplingId() {
+    return uint64_t(RankSample) | uint64_t(RankSubSample) << 21 |
+           uint64_t(SelectSample) << 42;
+  }
+  FileHeader fileHeader() const {
+    FileHeader h = {};
+    h.magic = FileMagic;
+    h.size = size_;
+    h.popcount = popcount_;
+    h.sampling = SamplingId();
+    if (bits_ != nullptr) {
+      h.word_count = 1 + size_ / WordBits;
+      h.rank_count = 2 + size_ / RankSample;
+      if (HasSelectSamples) {
+        h.select_count[0] = 2 + (size_ - popcount_) / selectStep();
+        h.select_count[1] = 2 + popcount_ / selectStep();
+      }
+    }
+    return h;
+  }
+  // Zeroes bits_ past size_ in the last word.
+  void clearPadding() {
+    unsigned used = size_ % WordBits;
+    bits_[size_ / WordBits] &= (1UL << used) - 1;
+  }
+  // Computes popcount_, rank_samples_ and select_samples_ from bits_.
+  void initSamples();
+  // Packs the relative ranks of the rank block in words[0, count) to *rel.
+  // Returns the number of ones in the block.
+  static size_t BlockRanks(const unsigned long* words, size_t count,
+                           uint64_t* rel) {
+    const size_t sub_words = RankSubSample / WordBits;
+    uint64_t sub_block[SubBlocks] = {};
+    size_t w = 0;
+    for (unsigned j = 0; j < SubBlocks && w < count; ++j, w += sub_words) {
+      size_t bits = std::min(count - w, sub_words) * WordBits;
+      sub_block[j] = PrefixPopcount(&words[w], bits);
+    }
+    for (unsigned j = 1; j < SubBlocks; ++j) {
+      sub_block[j] += sub_block[j-1];
+    }
+    // Put in reverse order to remove branch for sub_block = 0
+    *rel = 0;
+    for (unsigned j = 0; j + 1 < SubBlocks; ++j) {
+      *rel |= sub_block[j] << (RelBits * (SubBlocks - 2 - j));
+    }
+    return sub_block[SubBlocks - 1];
+  }
+
+  // SelectSample, but never 0 to keep disabled select sampling compiling.
+  static size_t selectStep() {
+    return HasSelectSamples ? SelectSample : 1;
+  }
+
+  // Range of rank blocks holding the idx:th bit value.
+  void selectRange(size_t idx, bool bit, size_t* left, size_t* right) const {
+    if (HasSelectSamples) {
+      size_t block = idx / selectStep();
+      *left = select_samples_[bit][block];
+      *right = select_samples_[bit][block + 1];
+    } else {
+      *left = 0;
+      *right = 1 + size_ / RankSample;
+    }
+  }
+
+  // Prefetches everything rank(pos, *) reads: the rank block, the first word
+  // of the sub-block and the word containing pos.
+  void prefetchRank(size_t pos) const {
+    size_t block = pos / RankSample;
+    size_t sub_block = (pos % RankSample) / RankSubSample;
+    size_t word = (block * RankSample + sub_block * RankSubSample) / WordBits;
+    __builtin_prefetch(&rank_samples_[RankWords * block]);
+    __builtin_prefetch(&bits_[word]);
+    __builtin_prefetch(&bits_[pos / WordBits]);
+  }
+
+  void prefetchSelectSample(size_t idx, bool bit) const {
+    if (!HasSelectSamples) return;
+    __builtin_prefetch(&select_samples_[bit][idx / selectStep()]);
+  }
+
+  // Prefetches the rank blocks the binary search in select starts from.
+  // Select samples for idx should already be in cache.
+  void prefetchSelectRank(size_t idx, bool bit) const {
+    if (idx == 0 || !HasSelectSamples) return;
+    size_t left, right;
+    selectRange(idx, bit, &left, &right);
+    __builtin_prefetch(&rank_samples_[RankWords * left]);
+    __builtin_prefetch(&rank_samples_[RankWords * ((left + right) / 2)]);
+  }
+
+  size_t rankAbs(size_t block) const {
+    return rank_samples_[RankWords * block];
+  }
+
   size_t subBlockRank(size_t block, int sub_block) const {
-      return (rank_samples_[block].rel >> (11ull * (5 - sub_block))) & 0x7FFull;
+    if (SubBlocks == 1) return 0;
+    uint64_t rel = rank_samples_[RankWords * block + 1];
+    return (rel >> (RelBits * (SubBlocks - 1 - sub_block))) &
+           ((1ull << RelBits) - 1);
   }
 
   size_t size_;
   size_t popcount_;
 
   unsigned long* bits_;
-  struct RankBlock {
-    uint64_t abs;
-    uint64_t rel;
-  };
-
-  RankBlock* rank_samples_;
+  // RankWords words per rank block, see the on-disk layout.
+  uint64_t* rank_samples_;
   // uint32_t is enough for 2048 * 2^32 bits = 1TB
   // Should be good enough for few years.
   uint32_t* select_samples_[2];
+  // Non-null when the arrays point into a read-only file mapping.
+  void* mapping_;
+  size_t mapping_size_;
 };
 
+typedef BasicFastBitVector<> FastBitVector;
+
+// Builds a BitVector of size bits from packed words holding 1 + size / 64
+// words. Types with a packed words constructor adopt the words, others are
+// built through std::vector<bool>.
+template<typename BitVector>
+BitVector BitVectorFromWords(std::unique_ptr<unsigned long[]> words,
+                             size_t size, std::true_type) {
+  return BitVector(std::move(words), size);
+}
+
+template<typename BitVector>
+BitVector BitVectorFromWords(std::unique_ptr<unsigned long[]> words,
+                             size_t size, std::false_type) {
+  std::vector<bool> bits(size);
+  for (size_t i = 0; i < size; ++i) {
+    bits[i] = (words[i / 64] >> (i % 64)) & 1;
+  }
+  words.reset();
+  return BitVector(bits);
+}
+
+template<typename BitVector>
+BitVector BitVectorFromWords(std::unique_ptr<unsigned long[]> words,
+                             size_t size) {
+  typedef std::is_constructible<
+      BitVector, std::unique_ptr<unsigned long[]>&&, size_t> Adopts;
+  return BitVectorFromWords<BitVector>(std::move(words), size, Adopts());
+}
+
+template<typename Policy>
+BasicFastBitVector<Policy>::BasicFastBitVector(const std::vector<bool>& data)
+    : BasicFastBitVector() {
+  size_ = data.size();
+  const size_t word_count = 1 + size_ / WordBits;
+  bits_ = new unsigned long[word_count];
+  memset(bits_, 0, word_count * sizeof(long));
+  // Init bits.
+  for (size_t i = 0; i < data.size(); ++i) {
+    long p = i / WordBits;
+    long o = i % WordBits;
+    bits_[p] |= (unsigned long)(data[i]) << o;
+  }
+  initSamples();
+}
+
+template<typename Policy>
+BasicFastBitVector<Policy>::BasicFastBitVector(const unsigned long* words,
+                                               size_t size)
+    : BasicFastBitVector() {
+  size_ = size;
+  const size_t word_count = 1 + size_ / WordBits;
+  bits_ = new unsigned long[word_count];
+  const size_t used = (size_ + WordBits - 1) / WordBits;
+  memcpy(bits_, words, used * sizeof(long));
+  memset(bits_ + used, 0, (word_count - used) * sizeof(long));
+  clearPadding();
+  initSamples();
+}
+
+template<typename Policy>
+BasicFastBitVector<Policy>::BasicFastBitVector(
+    std::unique_ptr<unsigned long[]> words, size_t size)
+    : BasicFastBitVector() {
+  size_ = size;
+  bits_ = words.release();
+  clearPadding();
+  initSamples();
+}
+
+template<typename Policy>
+void BasicFastBitVector<Policy>::initSamples() {
+  const size_t blocks = 1 + size_ / RankSample;
+  const size_t word_count = 1 + size_ / WordBits;
+  const size_t block_words = RankSample / WordBits;
+
+  // Init rank samples.
+  // Blocks are independent, so they are split between threads. Block sums
+  // go to the absolute rank of block i + 1 and are summed up afterwards.
+  rank_samples_ = new uint64_t[RankWords * (blocks + 1)];
+  auto fill = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      size_t w = i * block_words;
+      uint64_t rel;
+      size_t ones = BlockRanks(&bits_[w], std::min(word_count - w, block_words),
+                               &rel);
+      if (RankWords == 2) rank_samples_[RankWords * i + 1] = rel;
+      rank_samples_[RankWords * (i + 1)] = ones;
+    }
+  };
+  size_t threads = std::min<size_t>(std::thread::hardware_concurrency(),
+                                    blocks / MinThreadBlocks);
+  if (threads <= 1) {
+    fill(0, blocks);
+  } else {
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+      pool.emplace_back(fill, blocks * t / threads,
+                        blocks * (t + 1) / threads);
+    }
+    for (auto& th : pool) th.join();
+  }
+  rank_samples_[0] = 0;
+  if (RankWords == 2) rank_samples_[RankWords * blocks + 1] = 0;
+  for (size_t i = 1; i <= blocks; ++i) {
+    rank_samples_[RankWords * i] += rank_samples_[RankWords * (i - 1)];
+  }
+  popcount_ = rank_samples_[RankWords * blocks];
+
+  if (!HasSelectSamples) return;
+  // Init select samples.
+  // Sample k is the rank block holding the (k * SelectSample):th bit value.
+  select_samples_[1] = new uint32_t[2 + popcount_ / selectStep()];
+  select_samples_[0] = new uint32_t[2 + (size_ - popcount_) / selectStep()];
+  size_t idx[2] = {1, 1};
+  select_samples_[0][0] = select_samples_[1][0] = 0;
+  for (size_t i = 0; i < blocks; i++) {
+    size_t block_end = std::min<size_t>(size_, (i + 1) * RankSample);
+    size_t sums[2];
+    sums[1] = rankAbs(i + 1);
+    sums[0] = block_end - sums[1];
+    for (int bit = 0; bit < 2; ++bit) {
+      while (idx[bit] * selectStep() <= sums[bit]) {
+        select_samples_[bit][idx[bit]++] = i;
+      }
+    }
+  }
+  select_samples_[0][idx[0]] = blocks;
+  select_samples_[1][idx[1]] = blocks;
+}
+
+template<typename Policy>
+bool BasicFastBitVector<Policy>::SaveFromFile(
+    FILE* words, size_t size, const char* path, const void* header,
+    size_t header_bytes, size_t memory_limit) {
+  const size_t word_count = 1 + size / WordBits;
+  const size_t block_words = RankSample / WordBits;
+  const size_t blocks = 1 + size / RankSample;
+  FileHeader h = {};
+  h.magic = FileMagic;
+  h.size = size;
+  h.sampling = SamplingId();
+  h.word_count = word_count;
+  h.rank_count = blocks + 1;
+
+  FILE* out = fopen(path, "wb");
+  if (out == nullptr) return false;
+  // Rank and select samples go to temporary files while the bits are
+  // copied, and are appended after them.
+  FILE* ranks = tmpfile();
+  FILE* select[2] = {tmpfile(), tmpfile()};
+  bool ok = ranks != nullptr && select[0] != nullptr && select[1] != nullptr;
+  if (header_bytes != 0) {
+    ok = ok && fwrite(header, header_bytes, 1, out) == 1 &&
+         WritePadding(out, header_bytes);
+  }
+  const long header_pos = ftell(out);
+  ok = ok && fwrite(&h, sizeof(h), 1, out) == 1 &&
+       WritePadding(out, sizeof(h));
+
+  const size_t chunk_blocks = std::max<size_t>(
+      1, memory_limit / (block_words * sizeof(long)));
+  std::vector<unsigned long> buf(chunk_blocks * block_words);
+  uint64_t ones = 0;
+  size_t idx[2] = {1, 1};
+  uint32_t sample = 0;
+  if (HasSelectSamples && ok) {
+    ok = fwrite(&sample, sizeof(sample), 1, select[0]) == 1 &&
+         fwrite(&sample, sizeof(sample), 1, select[1]) == 1;
+  }
+  for (size_t done = 0; done < word_count && ok; done += buf.size()) {
+    size_t n = std::min(buf.size(), word_count - done);
+    ok = fread(&buf[0], sizeof(long), n, words) == n &&
+         fwrite(&buf[0], sizeof(long), n, out) == n;
+    for (size_t w = 0; w < n && ok; w += block_words) {
+      size_t i = (done + w) / block_words;
+      uint64_t entry[2] = {ones, 0};
+      ones += BlockRanks(&buf[w], std::min(n - w, block_words), &entry[1]);
+      ok = fwrite(entry, sizeof(uint64_t), RankWords, ranks) == RankWords;
+      if (!HasSelectSamples) continue;
+      size_t block_end = std::min<size_t>(size, (i + 1) * RankSample);
+      size_t sums[2] = {block_end - ones, ones};
+      for (int bit = 0; bit < 2 && ok; ++bit) {
+        sample = i;
+        while (ok && idx[bit] * selectStep() <= sums[bit]) {
+          ok = fwrite(&sample, sizeof(sample), 1, select[bit]) == 1;
+          idx[bit]++;
+        }
+      }
+    }
+  }
+  uint64_t last[2] = {ones, 0};
+  ok = ok && fwrite(last, sizeof(uint64_t), RankWords, ranks) == RankWords;
+  h.popcount = ones;
+  if (HasSelectSamples) {
+    sample = blocks;
+    for (int bit = 0; bit < 2 && ok; ++bit) {
+      ok = fwrite(&sample, sizeof(sample), 1, select[bit]) == 1;
+    }
+    h.select_count[0] = 2 + (size - ones) / selectStep();
+    h.select_count[1] = 2 + ones / selectStep();
+  }
+
+  ok = ok && WritePadding(out, word_count * sizeof(long));
+  rewind(ranks);
+  ok = ok && CopySection(ranks, out,
+                         h.rank_count * RankWords * sizeof(uint64_t));
+  for (int bit = 0; bit < 2 && ok; ++bit) {
+    rewind(select[bit]);
+    ok = CopySection(select[bit], out, h.select_count[bit] * sizeof(uint32_t));
+  }
+  ok = ok && fseek(out, header_pos, SEEK_SET) == 0 &&
+       fwrite(&h, sizeof(h), 1, out) == 1;
+  if (ranks != nullptr) fclose(ranks);
+  if (select[0] != nullptr) fclose(select[0]);
+  if (select[1] != nullptr) fclose(select[1]);
+  return fclose(out) == 0 && ok;
+}
+
+// Read-only bitvector answering queries straight from a file written by
+// save, mapped with mmap. Nothing is copied, so several processes mapping
+// the same file share it through the page cache.
+template<typename Policy = DefaultSampling>
+class BasicFastBitVectorView {
+  typedef BasicFastBitVector<Policy> Vector;
+ public:
+  BasicFastBitVectorView() { }
+  BasicFastBitVectorView(const BasicFastBitVectorView& other) = delete;
+  BasicFastBitVectorView(BasicFastBitVectorView&& other)
+      : vec_(std::move(other.vec_)) { }
+  const BasicFastBitVectorView& operator=(BasicFastBitVectorView&& other) {
+    swap(vec_, other.vec_);
+    return *this;
+  }
+
+  // Maps the file at path, with the vector at offset, a multiple of 64.
+  // Returns false if it can not be opened or is not a valid bitvector file
+  // for this sampling policy.
+  bool open(const char* path, size_t offset = 0) {
+    typedef typename Vector::FileHeader FileHeader;
+    size_t length;
+    void* map = MapFile(path, &length);
+    if (map == nullptr) return false;
+    if (offset % 64 != 0 || length < offset + sizeof(FileHeader)) {
+      UnmapFile(map, length);
+      return false;
+    }
+    char* base = static_cast<char*>(map) + offset;
+    const FileHeader& h = *reinterpret_cast<const FileHeader*>(base);
+    // The counts must match size and popcount, so rank and select stay in
+    // their sections, and size must fit in the file before sizing them.
+    if (h.magic != Vector::FileMagic || h.sampling != Vector::SamplingId() ||
+        h.size / 8 > length || !Vector::ValidFileHeader(h)) {
+      UnmapFile(map, length);
+      return false;
+    }
+    size_t section[5];
+    section[0] = FileAlign(sizeof(FileHeader));
+    section[1] = section[0] + FileAlign(h.word_count * sizeof(long));
+    section[2] = section[1] + FileAlign(
+        h.rank_count * Vector::RankWords * sizeof(uint64_t));
+    section[3] = section[2] + FileAlign(h.select_count[0] * sizeof(uint32_t));
+    section[4] = section[3] + FileAlign(h.select_count[1] * sizeof(uint32_t));
+    // The last rank sample holds the popcount.
+    if (offset + section[4] > length ||
+        (h.rank_count != 0 && reinterpret_cast<const uint64_t*>(
+             base + section[1])[Vector::RankWords * (h.rank_count - 1)] !=
+         h.popcount)) {
+      UnmapFile(map, length);
+      return false;
+    }
+
+    Vector vec;
+    vec.size_ = h.size;
+    vec.popcount_ = h.popcount;
+    vec.bits_ = reinterpret_cast<unsigned long*>(base + section[0]);
+    vec.rank_samples_ = reinterpret_cast<uint64_t*>(base + section[1]);
+    if (Vector::HasSelectSamples) {
+      vec.select_samples_[0] = reinterpret_cast<uint32_t*>(base + section[2]);
+      vec.select_samples_[1] = reinterpret_cast<uint32_t*>(base + section[3]);
+    }
+    vec.mapping_ = map;
+    vec.mapping_size_ = length;
+    swap(vec_, vec);
+    return true;
+  }
+
+  bool operator[](size_t pos) const {
+    return vec_[pos];
+  }
+  size_t rank(size_t pos, bool bit_value) const {
+    return vec_.rank(pos, bit_value);
+  }
+  bool accessRank(size_t pos, size_t* rank) const {
+    return vec_.accessRank(pos, rank);
+  }
+  size_t select(size_t idx, bool bit) const {
+    return vec_.select(idx, bit);
+  }
+  size_t size() const {
+    return vec_.size();
+  }
+  size_t count(bool bit) const {
+    return vec_.count(bit);
+  }
+  size_t bitSize() const {
+    return vec_.bitSize();
+  }
+  // The mapped vector, for operations not forwarded here.
+  const Vector& vector() const {
+    return vec_;
+  }
+ private:
+  static size_t FileAlign(size_t bytes) {
+    return (bytes + 63) & ~size_t(63);
+  }
+  Vector vec_;
+};
+
+typedef BasicFastBitVectorView<> FastBitVectorView;
+
 #endif
@@ -1,4 +1,6 @@
 #include "fast-bit-vector.h"
+#include "interleaved-bit-vector.h"
+#include "dense-select-bit-vector.h"
 #include <iostream>
 #include <random>
 #include <chrono>
@@ -103,6 +105,125 @@ void SelectSparse(int iters) {
   std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/sel\n";
 }
 
+// Compares scalar rank/select against the batched versions on the same
+// random queries.
+void Batch(int iters) {
+  const size_t size = 1<<28;
+  const size_t batch = 1024;
+  std::cout << "Batch vs scalar:\n";
+  using namespace std::chrono;
+  std::mt19937_64 mt(time(0));
+  std::vector<bool> v;
+  for (size_t j = 0; j < size; ++j) {
+    v.push_back(mt()%2);
+  }
+  FastBitVector vec(v);
+  std::vector<size_t> pos(iters);
+  std::vector<size_t> idx(iters);
+  for (int j = 0; j < iters; ++j) {
+    pos[j] = mt() % size;
+    idx[j] = mt() % (size / 4);
+  }
+  std::vector<size_t> out(iters);
+  std::chrono::high_resolution_clock clock;
+  unsigned long long total = 0;
+
+  auto start = clock.now();
+  for (int j = 0; j < iters; ++j) {
+    out[j] = vec.rank(pos[j], 1);
+  }
+  auto end = clock.now();
+  for (int j = 0; j < iters; ++j) total += out[j];
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/rank\n";
+
+  start = clock.now();
+  for (int j = 0; j < iters; j += batch) {
+    size_t n = std::min<size_t>(batch, iters - j);
+    vec.rankBatch(&pos[j], 1, &out[j], n);
+  }
+  end = clock.now();
+  for (int j = 0; j < iters; ++j) total -= out[j];
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/rank (batch)\n";
+
+  start = clock.now();
+  for (int j = 0; j < iters; ++j) {
+    out[j] = vec.select(idx[j], 1);
+  }
+  end = clock.now();
+  for (int j = 0; j < iters; ++j) total += out[j];
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/sel\n";
+
+  start = clock.now();
+  for (int j = 0; j < iters; j += batch) {
+    size_t n = std::min<size_t>(batch, iters - j);
+    vec.selectBatch(&idx[j], 1, &out[j], n);
+  }
+  end = clock.now();
+  for (int j = 0; j < iters; ++j) total -= out[j];
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/sel (batch)\n";
+  // Batch and scalar results cancel out.
+  std::cout << "total = " << total << endl;
+}
+
+// Select on skewed data: dense runs separated by long sparse gaps.
+template<typename BitVector>
+void SelectSkewed(int iters, const char* name) {
+  const size_t size = 1<<26;
+  std::cout << name << "::select skewed:\n";
+  using namespace std::chrono;
+  std::mt19937_64 mt(time(0));
+  std::vector<bool> v;
+  while (v.size() < size) {
+    size_t run = 1 + mt() % (1 << 16);
+    unsigned rarity = v.size() / run % 2 ? 2 : 1 << 12;
+    for (size_t j = 0; j < run && v.size() < size; ++j) {
+      v.push_back(mt() % rarity == 0);
+    }
+  }
+  BitVector vec(v);
+  std::chrono::high_resolution_clock clock;
+  auto start = clock.now();
+  unsigned long long total = 0;
+  for (int j = 0; j < iters; ++j) {
+    bool b = total % 2;
+    total = total * 178923 + 987341;
+    total += vec.select(1 + total % vec.count(b), b);
+  }
+  std::cout << "total = " << total << endl;
+  auto end = clock.now();
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/sel, ";
+  std::cout << double(vec.bitSize()) / vec.size() << " bits/bit\n";
+}
+
+// Random rank on 2^log_size bits, to compare memory layouts.
+template<typename BitVector>
+void RankLayout(int log_size, int iters, const char* name) {
+  const size_t size = 1ull << log_size;
+  std::cout << name << "::rank 2^" << log_size << " bits:\n";
+  using namespace std::chrono;
+  std::mt19937_64 mt(time(0));
+  std::vector<bool> v(size);
+  for (size_t j = 0; j < size; j += 64) {
+    uint64_t w = mt();
+    for (size_t k = 0; k < 64 && j + k < size; ++k) {
+      v[j + k] = (w >> k) & 1;
+    }
+  }
+  BitVector vec(v);
+  v = std::vector<bool>();
+  std::chrono::high_resolution_clock clock;
+  auto start = clock.now();
+  unsigned long long total = 0;
+  for (int j = 0; j < iters; ++j) {
+    total = total * 178923 + 987341;
+    total += vec.rank(total % size, total%2);
+  }
+  std::cout << "total = " << total << endl;
+  auto end = clock.now();
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/rank, ";
+  std::cout << double(vec.bitSize()) / vec.size() << " bits/bit\n";
+}
+
 void Construct() {
   const size_t size = 1<<25;
   std::cout << "Construct " << size << " bits:\n";
@@ -122,11 +243,39 @@ void Construct() {
   std::cout << (size / (8 * 1024 * 1024.0)) / (ms / 1000.0) << " MB/s\n";
 }
 
+void ConstructWords() {
+  const size_t size = 1<<28;
+  std::cout << "Construct " << size << " bits from words:\n";
+  using namespace std::chrono;
+  std::mt19937_64 mt(time(0));
+  std::vector<unsigned long> words(1 + size / 64);
+  for (size_t j = 0; j < words.size(); ++j) {
+    words[j] = mt();
+  }
+  std::chrono::high_resolution_clock clock;
+  auto start = clock.now();
+  FastBitVector vec(&words[0], size);
+  auto end = clock.now();
+  std::cout << "(" << vec.count(1) << ")\n";
+  long ms = duration_cast<std::chrono::milliseconds>(end-start).count();
+  std::cout << ms << "ms\n";
+  std::cout << (size / (8 * 1024 * 1024.0)) / (ms / 1000.0) << " MB/s\n";
+}
+
 
 int main() {
+  std::cout << "Popcount kernel: " << PopcountKernelName() << "\n";
   Rank(10000000);
   Select(10000000);
   RankSparse(10000000);
   SelectSparse(10000000);
+  Batch(10000000);
+  SelectSkewed<FastBitVector>(10000000, "FastBitVector");
+  SelectSkewed<DenseSelectBitVector>(10000000, "DenseSelectBitVector");
+  for (int log_size = 20; log_size <= 32; log_size += 4) {
+    RankLayout<FastBitVector>(log_size, 10000000, "FastBitVector");
+    RankLayout<InterleavedBitVector>(log_size, 10000000, "InterleavedBitVector");
+  }
   Construct();
+  ConstructWords();
 }
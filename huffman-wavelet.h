@@ -0,0 +1,302 @@
+#ifndef HUFFMAN_WAVELET_H
+#define HUFFMAN_WAVELET_H
+
+#include "fast-bit-vector.h"
+#include <stdint.h>
+#include <cassert>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+// Huffman-shaped wavelet tree: value v has a leaf at depth equal to its
+// Huffman code length, so the bits stored total about n * H0 and the
+// average query visits H0 + 1 levels instead of log sigma.
+//
+// Codes are canonical, so at every depth the codes ending there are
+// numerically smaller than the prefixes of longer codes. Level d stores,
+// for the values with codes longer than d, grouped by their d-bit prefix
+// in increasing order, bit d of the code. Children of the nodes of level
+// d in order are then level d + 1 preceded by the leaves at depth d + 1,
+// and nodes are found by arithmetic on ranks as in BalancedWavelet.
+// The codes do not preserve the order of values, so there is no rankLE.
+template<typename BitVector = FastBitVector>
+class HuffmanWavelet {
+  static const int MaxDepth = 64;
+ public:
+  template<typename It>
+  HuffmanWavelet(It begin, It end)
+      : HuffmanWavelet(std::vector<uint64_t>(begin, end)) { }
+
+  HuffmanWavelet(const std::vector<uint64_t>& vec) : size_(vec.size()) {
+    if (size_ == 0) return;
+    initCodes(vec);
+    // Codes of every value, left aligned.
+    std::vector<uint64_t> cur(size_);
+    for (size_t i = 0; i < size_; ++i) {
+      int len;
+      uint64_t code = encode(vec[i], &len);
+      cur[i] = code << (MaxDepth - len);
+    }
+    std::vector<bool> level;
+    for (int d = 0; !cur.empty(); ++d) {
+      level.resize(cur.size());
+      for (size_t i = 0; i < cur.size(); ++i) {
+        level[i] = (cur[i] >> (MaxDepth - 1 - d)) & 1;
+      }
+      levels_.emplace_back(level);
+      // Stable partition of every node by bit d.
+      auto prefix = [&](uint64_t x) -> uint64_t {
+        return d == 0 ? 0 : x >> (MaxDepth - d);
+      };
+      size_t start = 0;
+      for (size_t i = 1; i <= cur.size(); ++i) {
+        if (i == cur.size() || prefix(cur[i]) != prefix(cur[start])) {
+          std::stable_partition(&cur[start], &cur[0] + i, [&](uint64_t x) {
+            return ((x >> (MaxDepth - 1 - d)) & 1) == 0;
+          });
+          start = i;
+        }
+      }
+      // Codes ending at depth d + 1 are the smallest prefixes, in front.
+      const size_t leaves = leaf_values_[d + 1];
+      for (size_t i = 0; i < leaves; ++i) {
+        assert(isLeaf(d + 1, cur[i] >> (MaxDepth - 1 - d)));
+      }
+      cur.erase(cur.begin(), cur.begin() + leaves);
+    }
+  }
+
+  HuffmanWavelet(const HuffmanWavelet& o) = delete;
+
+  HuffmanWavelet() : size_(0) { }
+
+  HuffmanWavelet(HuffmanWavelet&& o)
+      : levels_(std::move(o.levels_)),
+        leaf_values_(std::move(o.leaf_values_)),
+        first_code_(std::move(o.first_code_)),
+        code_count_(std::move(o.code_count_)),
+        first_symbol_(std::move(o.first_symbol_)),
+        symbols_(std::move(o.symbols_)),
+        sorted_values_(std::move(o.sorted_values_)),
+        sorted_codes_(std::move(o.sorted_codes_)),
+        size_(o.size_) { }
+
+  const HuffmanWavelet& operator=(HuffmanWavelet&& o) {
+    levels_ = std::move(o.levels_);
+    leaf_values_ = std::move(o.leaf_values_);
+    first_code_ = std::move(o.first_code_);
+    code_count_ = std::move(o.code_count_);
+    first_symbol_ = std::move(o.first_symbol_);
+    symbols_ = std::move(o.symbols_);
+    sorted_values_ = std::move(o.sorted_values_);
+    sorted_codes_ = std::move(o.sorted_codes_);
+    size_ = o.size_;
+    o.size_ = 0;
+    return *this;
+  }
+
+  size_t rank(size_t pos, uint64_t value) const {
+    assert(pos <= size());
+    int len;
+    uint64_t code = encode(value, &len);
+    if (len == 0) return 0;
+    // Node [begin, end) and pos on level d.
+    size_t begin = 0, end = size_;
+    for (int d = 0;; ++d) {
+      bool bit = (code >> (len - 1 - d)) & 1;
+      size_t begin_rank;
+      size_t nbegin = child(d, begin, end, bit, &end, &begin_rank);
+      pos = nbegin + levels_[d].rank(pos, bit) - begin_rank;
+      if (d + 1 == len) return pos - nbegin;
+      begin = nbegin - leaf_values_[d + 1];
+      end -= leaf_values_[d + 1];
+      pos -= leaf_values_[d + 1];
+    }
+  }
+
+  uint64_t operator[](size_t i) const {
+    size_t begin = 0, end = size_;
+    uint64_t code = 0;
+    for (int d = 0;; ++d) {
+      size_t r;
+      bool bit = levels_[d].accessRank(i, &r);
+      size_t begin_rank;
+      size_t nbegin = child(d, begin, end, bit, &end, &begin_rank);
+      i = nbegin + r - begin_rank;
+      code = (code << 1) | bit;
+      if (isLeaf(d + 1, code)) {
+        return symbols_[first_symbol_[d + 1] + code - first_code_[d + 1]];
+      }
+      begin = nbegin - leaf_values_[d + 1];
+      end -= leaf_values_[d + 1];
+      i -= leaf_values_[d + 1];
+    }
+  }
+
+  // Returns smallest position pos so that rank(pos, value) == rank.
+  size_t select(size_t rank, uint64_t value) const {
+    if (rank == 0) return 0;
+    int len;
+    uint64_t code = encode(value, &len);
+    if (len == 0) return 0;
+    // Start of the child taken and rank of its bit at the node start.
+    size_t child_begin[MaxDepth], begin_rank[MaxDepth];
+    size_t begin = 0, end = size_;
+    for (int d = 0; d < len; ++d) {
+      bool bit = (code >> (len - 1 - d)) & 1;
+      child_begin[d] = child(d, begin, end, bit, &end, &begin_rank[d]);
+      begin = child_begin[d] - leaf_values_[d + 1];
+      end -= leaf_values_[d + 1];
+    }
+    size_t pos = child_begin[len - 1] + rank;
+    for (int d = len - 1; d >= 0; --d) {
+      bool bit = (code >> (len - 1 - d)) & 1;
+      pos = levels_[d].select(begin_rank[d] + pos - child_begin[d], bit);
+      if (d > 0) pos += leaf_values_[d];
+    }
+    return pos;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  size_t bitSize() const {
+    size_t ret = sizeof(*this) * 8;
+    for (size_t d = 0; d < levels_.size(); ++d) {
+      ret += levels_[d].bitSize();
+    }
+    ret += (leaf_values_.size() + first_code_.size() + code_count_.size() +
+            first_symbol_.size()) * 64;
+    ret += (symbols_.size() + sorted_values_.size() +
+            sorted_codes_.size()) * 64;
+    return ret;
+  }
+
+ private:
+  // Start of child bit of node [begin, end) of level d, in the children
+  // of level d. Sets *child_end to its end and *begin_rank to
+  // rank(begin, bit) on level d.
+  size_t child(int d, size_t begin, size_t end, bool bit,
+               size_t* child_end, size_t* begin_rank) const {
+    size_t begin_zeros = levels_[d].rank(begin, 0);
+    size_t zeros = levels_[d].rank(end, 0) - begin_zeros;
+    if (bit) {
+      *begin_rank = begin - begin_zeros;
+      *child_end = end;
+      return begin + zeros;
+    }
+    *begin_rank = begin_zeros;
+    *child_end = begin + zeros;
+    return begin;
+  }
+
+  bool isLeaf(int depth, uint64_t code) const {
+    return code - first_code_[depth] < code_count_[depth];
+  }
+
+  // Returns the code of value and sets *len to its length, 0 if value
+  // does not occur.
+  uint64_t encode(uint64_t value, int* len) const {
+    auto it = std::lower_bound(sorted_values_.begin(), sorted_values_.end(),
+                               value);
+    if (it == sorted_values_.end() || *it != value) {
+      *len = 0;
+      return 0;
+    }
+    uint64_t c = sorted_codes_[it - sorted_values_.begin()];
+    *len = c & 0xff;
+    return c >> 8;
+  }
+
+  // Computes Huffman code lengths from the frequencies and assigns
+  // canonical codes.
+  void initCodes(const std::vector<uint64_t>& vec) {
+    sorted_values_ = vec;
+    std::sort(sorted_values_.begin(), sorted_values_.end());
+    std::vector<size_t> freq;
+    size_t out = 0;
+    for (size_t i = 0; i < size_; ++i) {
+      if (i == 0 || sorted_values_[i] != sorted_values_[out - 1]) {
+        sorted_values_[out++] = sorted_values_[i];
+        freq.push_back(0);
+      }
+      freq.back()++;
+    }
+    sorted_values_.resize(out);
+    sorted_values_.shrink_to_fit();
+    const size_t sigma = out;
+
+    // Huffman tree over node ids, leaves are [0, sigma).
+    std::vector<size_t> parent(2 * sigma, 0);
+    typedef std::pair<size_t, size_t> Item;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+    for (size_t s = 0; s < sigma; ++s) queue.push(Item(freq[s], s));
+    size_t next = sigma;
+    while (queue.size() > 1) {
+      Item a = queue.top();
+      queue.pop();
+      Item b = queue.top();
+      queue.pop();
+      parent[a.second] = parent[b.second] = next;
+      queue.push(Item(a.first + b.first, next++));
+    }
+    // Depths, parents have larger ids. A single value gets length 1.
+    std::vector<int> depth(next, 0);
+    for (size_t v = next - 1; v-- > 0;) {
+      depth[v] = depth[parent[v]] + 1;
+    }
+    if (sigma == 1) depth[0] = 1;
+
+    std::vector<size_t> order(sigma);
+    for (size_t s = 0; s < sigma; ++s) order[s] = s;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return depth[a] != depth[b] ? depth[a] < depth[b] : a < b;
+    });
+    const int max_len = depth[order.back()];
+    // Lengths share a word with the code in sorted_codes_, and need
+    // Fibonacci-like frequencies over about 2^38 values to exceed this.
+    assert(max_len <= MaxDepth - 8);
+    first_code_.assign(max_len + 2, 0);
+    code_count_.assign(max_len + 2, 0);
+    first_symbol_.assign(max_len + 2, 0);
+    leaf_values_.assign(max_len + 2, 0);
+    symbols_.resize(sigma);
+    sorted_codes_.resize(sigma);
+    uint64_t code = 0;
+    int len = 0;
+    for (size_t i = 0; i < sigma; ++i) {
+      const size_t s = order[i];
+      while (len < depth[s]) {
+        code <<= 1;
+        ++len;
+        first_code_[len] = code;
+        first_symbol_[len] = i;
+      }
+      code_count_[len]++;
+      leaf_values_[len] += freq[s];
+      symbols_[i] = sorted_values_[s];
+      sorted_codes_[s] = (code << 8) | len;
+      ++code;
+    }
+    // Past the longest code nothing is a leaf.
+    first_code_[max_len + 1] = code << 1;
+  }
+
+  std::vector<BitVector> levels_;
+  // Number of values with codes of each length.
+  std::vector<size_t> leaf_values_;
+  // Canonical codes of length d are [first_code_[d],
+  // first_code_[d] + code_count_[d]), for symbols_ from first_symbol_[d].
+  std::vector<uint64_t> first_code_;
+  std::vector<uint64_t> code_count_;
+  std::vector<size_t> first_symbol_;
+  std::vector<uint64_t> symbols_;
+  // Distinct values, sorted, and their code << 8 | length.
+  std::vector<uint64_t> sorted_values_;
+  std::vector<uint64_t> sorted_codes_;
+  size_t size_;
+};
+
+#endif
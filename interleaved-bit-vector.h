@@ -0,0 +1,222 @@
+#pragma once
+// Uncompressed bitvector with rank counters stored inline with the data.
+// Each 64-byte cache line holds one counter word and 7 data words, so a
+// rank touches exactly one cache line (compare rank9 and poppy, which keep
+// the counters in a separate array).
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <stdint.h>
+
+#include "bit-utils.h"
+
+class InterleavedBitVector {
+  static const unsigned WordBits = 64;
+  static const unsigned LineWords = 7;
+  static const unsigned LineBits = LineWords * WordBits;
+  static const unsigned SelectSample = 4096;
+  // Counter word: bits [0, 46) ones before this line,
+  // [46, 55) ones in data words 0-1, [55, 64) ones in data words 0-3.
+  static const unsigned AbsBits = 46;
+  static const unsigned RelBits = 9;
+  struct Line {
+    uint64_t counts;
+    uint64_t words[LineWords];
+  };
+ public:
+  // Empty constructor.
+  InterleavedBitVector()
+      : size_(0),
+        popcount_(0),
+        line_count_(0),
+        lines_(nullptr) { }
+
+  explicit InterleavedBitVector(const std::vector<bool>& data)
+      : size_(data.size()),
+        popcount_(0) {
+    line_count_ = 1 + size_ / LineBits;
+    void* mem = nullptr;
+    // Fails like new would.
+    if (posix_memalign(&mem, 64, line_count_ * sizeof(Line)) != 0) {
+      throw std::bad_alloc();
+    }
+    lines_ = static_cast<Line*>(mem);
+    memset(lines_, 0, line_count_ * sizeof(Line));
+    for (size_t i = 0; i < size_; ++i) {
+      if (data[i]) {
+        size_t off = i % LineBits;
+        lines_[i / LineBits].words[off / WordBits] |= 1ULL << (off % WordBits);
+      }
+    }
+    init();
+  }
+
+  InterleavedBitVector(const InterleavedBitVector& other) = delete;
+  InterleavedBitVector(InterleavedBitVector&& other)
+      : InterleavedBitVector() {
+    swap(*this, other);
+  }
+  const InterleavedBitVector& operator=(InterleavedBitVector&& other) {
+    swap(*this, other);
+    return *this;
+  }
+  ~InterleavedBitVector() {
+    free(lines_);
+  }
+
+  bool operator[](size_t pos) const {
+    size_t off = pos % LineBits;
+    return (lines_[pos / LineBits].words[off / WordBits] >> (off % WordBits)) & 1;
+  }
+
+  // Number of positions < pos set with bit_value.
+  size_t rank(size_t pos, bool bit_value) const {
+    const Line& line = lines_[pos / LineBits];
+    unsigned off = pos % LineBits;
+    unsigned sub = std::min(off / WordBits / 2, 2u);
+    size_t sum = line.counts & ((1ULL << AbsBits) - 1);
+    // Shift so that sub-block 0 reads as zero.
+    uint64_t rel = (line.counts >> AbsBits) << RelBits;
+    sum += (rel >> (RelBits * sub)) & ((1ULL << RelBits) - 1);
+    sum += PrefixPopcount(&line.words[2 * sub], off - 2 * sub * WordBits);
+    if (bit_value == 0) return pos - sum;
+    return sum;
+  }
+
+  // Returns the bit at pos and sets *rank = rank(pos, bit).
+  // Same lookup as rank, but the word of pos is loaded once for both its
+  // prefix count and the bit.
+  bool accessRank(size_t pos, size_t* rank) const {
+    const Line& line = lines_[pos / LineBits];
+    unsigned off = pos % LineBits;
+    unsigned sub = std::min(off / WordBits / 2, 2u);
+    size_t sum = line.counts & ((1ULL << AbsBits) - 1);
+    uint64_t rel = (line.counts >> AbsBits) << RelBits;
+    sum += (rel >> (RelBits * sub)) & ((1ULL << RelBits) - 1);
+    unsigned w = off / WordBits;
+    // Whole words of the sub-block before the word of pos.
+    sum += PrefixPopcount(&line.words[2 * sub], (w - 2 * sub) * WordBits);
+    uint64_t word = line.words[w];
+    sum += __builtin_popcountll(word & ((1ULL << (off % WordBits)) - 1));
+    bool bit = (word >> (off % WordBits)) & 1;
+    *rank = bit ? sum : pos - sum;
+    return bit;
+  }
+
+  // Returns smallest position pos so that rank(pos,bit) == idx
+  size_t select(size_t idx, bool bit) const {
+    if (idx == 0) return 0;
+    assert(idx <= count(bit));
+    size_t block = idx / SelectSample;
+    size_t left = select_samples_[bit][block];
+    size_t right = select_samples_[bit][block + 1] + 1;
+    // Binary search for the last line with lineRank < idx.
+    while (left + 1 < right) {
+      size_t c = (left + right) / 2;
+      if (lineRank(c, bit) < idx) {
+        left = c;
+      } else {
+        right = c;
+      }
+    }
+    const Line& line = lines_[left];
+    size_t r = idx - lineRank(left, bit);
+    size_t c2 = (line.counts >> AbsBits) & ((1ULL << RelBits) - 1);
+    size_t c4 = line.counts >> (AbsBits + RelBits);
+    if (!bit) {
+      c2 = 2 * WordBits - c2;
+      c4 = 4 * WordBits - c4;
+    }
+    unsigned w = 0;
+    if (r > c4) {
+      w = 4;
+      r -= c4;
+    } else if (r > c2) {
+      w = 2;
+      r -= c2;
+    }
+    for (;; ++w) {
+      assert(w < LineWords);
+      uint64_t word = bit ? line.words[w] : ~line.words[w];
+      size_t pop = __builtin_popcountll(word);
+      if (r <= pop) {
+        return left * LineBits + w * WordBits + WordSelect(word, r);
+      }
+      r -= pop;
+    }
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  size_t count(bool bit) const {
+    if (bit) return popcount_;
+    return size() - popcount_;
+  }
+  size_t bitSize() const {
+    size_t samples = select_samples_[0].size() + select_samples_[1].size();
+    return line_count_ * sizeof(Line) * 8 + samples * 32 +
+           sizeof(*this) * 8;
+  }
+
+  friend void swap(InterleavedBitVector& a, InterleavedBitVector& b) {
+    using std::swap;
+    swap(a.size_, b.size_);
+    swap(a.popcount_, b.popcount_);
+    swap(a.line_count_, b.line_count_);
+    swap(a.lines_, b.lines_);
+    swap(a.select_samples_[0], b.select_samples_[0]);
+    swap(a.select_samples_[1], b.select_samples_[1]);
+  }
+
+ private:
+  // Number of bit values before line l.
+  size_t lineRank(size_t l, bool bit) const {
+    size_t ones = lines_[l].counts & ((1ULL << AbsBits) - 1);
+    return bit ? ones : l * LineBits - ones;
+  }
+
+  // Computes line counters and select samples once the data words are set.
+  void init() {
+    size_t sums[2] = {0, 0};
+    size_t next[2] = {1, 1};
+    select_samples_[0].assign(1, 0);
+    select_samples_[1].assign(1, 0);
+    for (size_t l = 0; l < line_count_; ++l) {
+      Line& line = lines_[l];
+      uint64_t pop[LineWords];
+      for (unsigned w = 0; w < LineWords; ++w) {
+        pop[w] = __builtin_popcountll(line.words[w]);
+      }
+      uint64_t c2 = pop[0] + pop[1];
+      uint64_t c4 = c2 + pop[2] + pop[3];
+      uint64_t ones = c4 + pop[4] + pop[5] + pop[6];
+      assert(sums[1] < (1ULL << AbsBits));
+      line.counts = sums[1] | (c2 << AbsBits) | (c4 << (AbsBits + RelBits));
+      size_t bits = std::min<size_t>(LineBits, size_ - l * LineBits);
+      size_t line_count[2] = {bits - ones, ones};
+      for (int b = 0; b < 2; ++b) {
+        sums[b] += line_count[b];
+        while (next[b] * SelectSample <= sums[b]) {
+          select_samples_[b].push_back(l);
+          next[b]++;
+        }
+      }
+    }
+    popcount_ = sums[1];
+    select_samples_[0].push_back(line_count_ - 1);
+    select_samples_[1].push_back(line_count_ - 1);
+  }
+
+  size_t size_;
+  size_t popcount_;
+  size_t line_count_;
+  Line* lines_;
+  // Line containing every SelectSample:th bit value, plus a sentinel.
+  std::vector<uint32_t> select_samples_[2];
+};
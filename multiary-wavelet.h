@@ -0,0 +1,368 @@
+#ifndef MULTIARY_WAVELET_H
+#define MULTIARY_WAVELET_H
+
+#include "bit-utils.h"
+#include <stdint.h>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+
+// Sequence of Bits-bit symbols, 64 / Bits per word, with rank and select
+// for every symbol. Each block of BlockWords words stores a 16-bit count
+// of every symbol since the start of its superblock of SuperWords words,
+// each superblock the absolute counts. Inside a block the words are
+// scanned with word-parallel compares of all symbols at once.
+template<unsigned Bits>
+class SymbolSequence {
+ public:
+  static const unsigned Sigma = 1 << Bits;
+  static_assert(Bits == 2 || Bits == 4, "Bits must be 2 or 4");
+
+  SymbolSequence() : size_(0) { }
+
+  // symbols[i] must be < Sigma.
+  explicit SymbolSequence(const std::vector<uint8_t>& symbols)
+      : size_(symbols.size()) {
+    const size_t nwords = size_ / PerWord + 1;
+    const size_t nblocks = nwords / BlockWords + 1;
+    const size_t nsupers = (nblocks * BlockWords + SuperWords - 1) /
+                           SuperWords;
+    words_.assign(nwords, 0);
+    for (size_t i = 0; i < size_; ++i) {
+      assert(symbols[i] < Sigma);
+      words_[i / PerWord] |= uint64_t(symbols[i]) << (i % PerWord * Bits);
+    }
+    block_.resize(nblocks * Sigma);
+    super_.resize(nsupers * Sigma);
+    uint64_t counts[Sigma] = {0};
+    for (size_t w = 0; w < nblocks * BlockWords; ++w) {
+      const size_t sb = w / SuperWords;
+      if (w % SuperWords == 0) {
+        for (unsigned c = 0; c < Sigma; ++c) super_[sb * Sigma + c] = counts[c];
+      }
+      if (w % BlockWords == 0) {
+        for (unsigned c = 0; c < Sigma; ++c) {
+          block_[w / BlockWords * Sigma + c] =
+              counts[c] - super_[sb * Sigma + c];
+        }
+      }
+      for (size_t i = w * PerWord; i < std::min(size_, (w + 1) * PerWord);
+           ++i) {
+        counts[symbols[i]]++;
+      }
+    }
+  }
+
+  unsigned operator[](size_t pos) const {
+    return (words_[pos / PerWord] >> (pos % PerWord * Bits)) & (Sigma - 1);
+  }
+
+  // Number of positions < pos holding c.
+  size_t rank(size_t pos, unsigned c) const {
+    const size_t w = pos / PerWord;
+    const size_t blk = w / BlockWords;
+    size_t r = super_[w / SuperWords * Sigma + c] + block_[blk * Sigma + c];
+    for (size_t i = blk * BlockWords; i < w; ++i) {
+      r += __builtin_popcountll(Equal(words_[i], c));
+    }
+    const unsigned k = pos % PerWord;
+    if (k != 0) {
+      r += __builtin_popcountll(Equal(words_[w], c) &
+                                ((1ULL << (k * Bits)) - 1));
+    }
+    return r;
+  }
+
+  // Number of positions < pos holding a symbol < c.
+  size_t rankLess(size_t pos, unsigned c) const {
+    if (c == 0) return 0;
+    const size_t w = pos / PerWord;
+    const size_t blk = w / BlockWords;
+    size_t r = 0;
+    for (unsigned d = 0; d < c; ++d) {
+      r += super_[w / SuperWords * Sigma + d] + block_[blk * Sigma + d];
+    }
+    for (size_t i = blk * BlockWords; i < w; ++i) {
+      r += Less(words_[i], c, PerWord);
+    }
+    const unsigned k = pos % PerWord;
+    if (k != 0) r += Less(words_[w], c, k);
+    return r;
+  }
+
+  // Returns rank(pos, c) and sets *less = rankLess(pos, c), with one scan.
+  size_t rankLess(size_t pos, unsigned c, size_t* less) const {
+    const size_t w = pos / PerWord;
+    const size_t blk = w / BlockWords;
+    const uint64_t* super = &super_[w / SuperWords * Sigma];
+    const uint16_t* block = &block_[blk * Sigma];
+    size_t r = super[c] + block[c];
+    size_t l = 0;
+    for (unsigned d = 0; d < c; ++d) l += super[d] + block[d];
+    for (size_t i = blk * BlockWords; i < w; ++i) {
+      r += __builtin_popcountll(Equal(words_[i], c));
+      if (c != 0) l += Less(words_[i], c, PerWord);
+    }
+    const unsigned k = pos % PerWord;
+    if (k != 0) {
+      r += __builtin_popcountll(Equal(words_[w], c) &
+                                ((1ULL << (k * Bits)) - 1));
+      if (c != 0) l += Less(words_[w], c, k);
+    }
+    *less = l;
+    return r;
+  }
+
+  // Returns smallest position pos so that rank(pos, c) == idx.
+  size_t select(size_t idx, unsigned c) const {
+    if (idx == 0) return 0;
+    // Last block with fewer than idx c's before it.
+    size_t left = 0, right = block_.size() / Sigma;
+    while (left + 1 < right) {
+      size_t m = (left + right) / 2;
+      if (blockRank(m, c) < idx) {
+        left = m;
+      } else {
+        right = m;
+      }
+    }
+    size_t r = idx - blockRank(left, c);
+    for (size_t i = left * BlockWords;; ++i) {
+      assert(i < words_.size());
+      uint64_t eq = Equal(words_[i], c);
+      size_t pop = __builtin_popcountll(eq);
+      if (r <= pop) {
+        return i * PerWord + (WordSelect(eq, r) - 1) / Bits + 1;
+      }
+      r -= pop;
+    }
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  size_t bitSize() const {
+    return words_.size() * 64 + super_.size() * 64 + block_.size() * 16 +
+           sizeof(*this) * 8;
+  }
+
+ private:
+  static const unsigned PerWord = 64 / Bits;
+  static const size_t BlockWords = 4 * Bits;
+  // Block counts are 16 bits.
+  static const size_t SuperWords = 1024;
+  static_assert(SuperWords * PerWord < (1 << 16), "block counts overflow");
+  // Lowest bit of every symbol.
+  static const uint64_t Low = ~0ULL / (Sigma - 1);
+  // Every other symbol, as a lane of 2 * Bits bits.
+  static const uint64_t LaneOne = ~0ULL / ((1ULL << (2 * Bits)) - 1);
+
+  // Sets the lowest bit of every symbol of w that equals c.
+  static uint64_t Equal(uint64_t w, unsigned c) {
+    uint64_t x = w ^ (Low * c);
+    for (unsigned s = 1; s < Bits; s <<= 1) x |= x >> s;
+    return ~x & Low;
+  }
+
+  // Number of the first k symbols of w that are < c, for c > 0.
+  // Even and odd symbols are compared separately in lanes of twice their
+  // width: lane value Sigma + c - 1 - x has bit Bits set iff x < c.
+  static unsigned Less(uint64_t w, unsigned c, unsigned k) {
+    const uint64_t symbols = LaneOne * (Sigma - 1);
+    const uint64_t high = LaneOne << Bits;
+    const uint64_t sub = LaneOne * (Sigma + c - 1);
+    // Even symbol j sets bit (j + 1) * Bits, odd symbol j bit j * Bits.
+    uint64_t even = (sub - (w & symbols)) & high;
+    uint64_t odd = (sub - ((w >> Bits) & symbols)) & high;
+    if (k != PerWord) {
+      even &= (1ULL << (k * Bits + 1)) - 1;
+      odd &= (1ULL << (k * Bits)) - 1;
+    }
+    return __builtin_popcountll(even) + __builtin_popcountll(odd);
+  }
+
+  size_t blockRank(size_t blk, unsigned c) const {
+    return super_[blk * BlockWords / SuperWords * Sigma + c] +
+           block_[blk * Sigma + c];
+  }
+
+  size_t size_;
+  std::vector<uint64_t> words_;
+  std::vector<uint64_t> super_;
+  std::vector<uint16_t> block_;
+};
+
+// Wavelet matrix over digits of log2(Arity) bits instead of single bits,
+// with the interface of BalancedWavelet. Level l stores digit l, from the
+// top, of every value in the order of the values stably sorted by their
+// digits above it. An alphabet of 2^20 takes 10 levels with Arity 4 and
+// 5 with Arity 16, at one symbol rank per level for access and two for
+// rank.
+template<unsigned Arity = 4>
+class MultiaryWavelet {
+  static const unsigned DigitBits = Arity == 4 ? 2 : 4;
+  static_assert(Arity == 4 || Arity == 16, "Arity must be 4 or 16");
+  typedef SymbolSequence<DigitBits> Sequence;
+ public:
+  template<typename IntType>
+  MultiaryWavelet(std::vector<IntType> && vec)
+      : MultiaryWavelet(&vec[0], vec.size()) { }
+
+  // Reorders vec.
+  template<typename IntType>
+  MultiaryWavelet(IntType* vec, size_t size)
+      : size_(size),
+        digits_(0) {
+    if (size == 0) return;
+    IntType max = *std::max_element(&vec[0], &vec[size]);
+    int bits = 1 + log2(max);
+    if (bits <= 0) bits = 1;
+    digits_ = (bits + DigitBits - 1) / DigitBits;
+    levels_.reserve(digits_);
+    less_.resize(digits_ * Arity);
+    std::vector<uint8_t> level(size_);
+    std::vector<IntType> sorted(size_);
+    for (int l = 0; l < digits_; ++l) {
+      const int shift = (digits_ - l - 1) * DigitBits;
+      size_t start[Arity] = {0};
+      for (size_t i = 0; i < size_; ++i) {
+        level[i] = (uint64_t(vec[i]) >> shift) & (Arity - 1);
+        start[level[i]]++;
+      }
+      levels_.emplace_back(level);
+      size_t sum = 0;
+      for (unsigned d = 0; d < Arity; ++d) {
+        less_[l * Arity + d] = sum;
+        sum += start[d];
+        start[d] = sum - start[d];
+      }
+      if (shift == 0) break;
+      // Stable counting sort by the digit.
+      for (size_t i = 0; i < size_; ++i) {
+        sorted[start[level[i]]++] = vec[i];
+      }
+      std::copy(sorted.begin(), sorted.end(), vec);
+    }
+  }
+
+  template<typename It>
+  MultiaryWavelet(It begin, It end)
+       : MultiaryWavelet(std::vector<
+                         typename std::iterator_traits<It>::value_type
+                         >(begin, end)) {
+  }
+
+  MultiaryWavelet(const MultiaryWavelet& o) = delete;
+
+  MultiaryWavelet() {
+    size_ = 0;
+    digits_ = 0;
+  }
+  MultiaryWavelet(MultiaryWavelet&& o)
+      : levels_(std::move(o.levels_)),
+        less_(std::move(o.less_)),
+        size_(o.size_),
+        digits_(o.digits_) { }
+
+  const MultiaryWavelet& operator=(MultiaryWavelet&& o) {
+    levels_ = std::move(o.levels_);
+    less_ = std::move(o.less_);
+    size_ = o.size_;
+    digits_ = o.digits_;
+    o.size_ = 0;
+    o.digits_ = 0;
+    return *this;
+  }
+
+  size_t rank(size_t pos, uint64_t value) const {
+    assert(pos <= size());
+    if (!inRange(value)) return 0;
+    size_t begin = 0;
+    for (int l = 0; l < digits_; ++l) {
+      unsigned d = digit(value, l);
+      begin = down(l, begin, d);
+      pos = down(l, pos, d);
+    }
+    return pos - begin;
+  }
+
+  size_t rankLE(size_t pos, uint64_t value) const {
+    assert(pos <= size());
+    if (!inRange(value)) return pos;
+    size_t ret = 0;
+    size_t begin = 0;
+    for (int l = 0; l < digits_; ++l) {
+      unsigned d = digit(value, l);
+      size_t less_begin, less_pos;
+      size_t nbegin = levels_[l].rankLess(begin, d, &less_begin);
+      size_t npos = levels_[l].rankLess(pos, d, &less_pos);
+      // Values with a smaller digit here are smaller.
+      ret += less_pos - less_begin;
+      begin = less_[l * Arity + d] + nbegin;
+      pos = less_[l * Arity + d] + npos;
+    }
+    return ret + pos - begin;
+  }
+
+  uint64_t operator[](size_t i) const {
+    uint64_t value = 0;
+    for (int l = 0; l < digits_; ++l) {
+      unsigned d = levels_[l][i];
+      i = down(l, i, d);
+      value = (value << DigitBits) | d;
+    }
+    return value;
+  }
+
+  // Returns smallest position pos so that rank(pos, value) == rank.
+  size_t select(size_t rank, uint64_t value) const {
+    if (rank == 0 || size_ == 0) return 0;
+    if (!inRange(value)) return 0;
+    // Start of the node of value on each level.
+    size_t begin[MaxDigits + 1];
+    begin[0] = 0;
+    for (int l = 0; l < digits_; ++l) {
+      begin[l + 1] = down(l, begin[l], digit(value, l));
+    }
+    // Walk up from the rank:th occurrence on the last level.
+    size_t pos = begin[digits_] + rank;
+    for (int l = digits_ - 1; l >= 0; --l) {
+      unsigned d = digit(value, l);
+      pos = levels_[l].select(pos - less_[l * Arity + d], d);
+    }
+    return pos;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  size_t bitSize() const {
+    size_t ret = sizeof(*this) * 8 + less_.size() * 64;
+    for (size_t l = 0; l < levels_.size(); ++l) {
+      ret += levels_[l].bitSize();
+    }
+    return ret;
+  }
+ private:
+  static const int MaxDigits = 64 / DigitBits;
+  bool inRange(uint64_t value) const {
+    return digits_ == MaxDigits || value >> (digits_ * DigitBits) == 0;
+  }
+  unsigned digit(uint64_t value, int l) const {
+    return (value >> ((digits_ - l - 1) * DigitBits)) & (Arity - 1);
+  }
+  // Position of pos on level l + 1 when following digit d.
+  size_t down(int l, size_t pos, unsigned d) const {
+    return less_[l * Arity + d] + levels_[l].rank(pos, d);
+  }
+
+  std::vector<Sequence> levels_;
+  // less_[l * Arity + d] is the number of digits < d on level l.
+  std::vector<size_t> less_;
+  size_t size_;
+  int digits_;
+};
+
+#endif
@@ -87,8 +87,12 @@ class RLEWavelet {
     size_t hrank = rpos;
     for (;;) {
       bool bit = value >= it.splitValue();
-      if (it[hrank] != bit) eq = false;
-      hrank = it.rank(hrank, bit);
+      size_t r;
+      if (it.accessRank(hrank, &r) != bit) {
+        eq = false;
+        r = hrank - r;
+      }
+      hrank = r;
       if (it.isLeaf()) {
         break;
       }
@@ -119,6 +123,41 @@ class RLEWavelet {
     return begin + end;
   }
 
+  // Number of values in [lo, hi] in positions [l, r). Full runs between
+  // the runs of l and r are counted in one traversal of the heads with
+  // both head positions, visiting only nodes that overlap [lo, hi] and hold
+  // some of those runs. The partial runs at l and r are then corrected.
+  size_t countRange(size_t l, size_t r, uint64_t lo, uint64_t hi) const {
+    if (l >= r || lo > hi) return 0;
+    size_t rl = headPos(l);
+    size_t rr = headPos(r);
+    size_t ret = 0;
+    if (rl < rr) {
+      ret = countRuns(typename Wavelet::Iterator(head_), rl, rr, lo, hi);
+    }
+    // count(pos) is the full runs before the run of pos plus pos minus
+    // its start, when its head is in range.
+    auto partial = [&](size_t pos, size_t rpos) -> size_t {
+      if (rpos >= head_.size()) return 0;
+      uint64_t h = headValue(rpos);
+      if (h < lo || h > hi) return 0;
+      size_t run_start = rpos == 0 ? 0 : run_end_.select1(rpos) - 1;
+      return pos - run_start;
+    };
+    return ret + partial(r, rr) - partial(l, rl);
+  }
+
+  // Writes the values in positions [l, r) to out. Each run overlapping
+  // the range has its head decoded once and is then expanded.
+  void extract(size_t l, size_t r, uint64_t* out) const {
+    size_t pos = l;
+    for (size_t run = headPos(l); pos < r; ++run) {
+      size_t run_end = std::min(r, run_end_.select1(run + 1) - 1);
+      std::fill(out + (pos - l), out + (run_end - l), headValue(run));
+      pos = run_end;
+    }
+  }
+
   // TODO
   // size_t select(size_t rank, uint64_t value) const {
   //   size_t run = 
@@ -149,11 +188,12 @@ class RLEWavelet {
   // *lt is set to false if head_[pos] > value.
   size_t rankLE(typename Wavelet::Iterator it, size_t pos, uint64_t value, bool* lt) const {
     if (it.count() == 0) return 0;
-    size_t pos1 = it.rank(pos, 1);
+    size_t r;
+    bool itb = it.accessRank(pos, &r);
+    size_t pos1 = itb ? r : pos - r;
     size_t pos0 = pos - pos1;
     uint64_t split = it.splitValue();
     bool b = value >= split;
-    bool itb = it[pos];
     // All values in the future will be smaller than value
     if (itb < b) lt = nullptr;
     if (lt != nullptr && b < itb) *lt = false;
@@ -178,6 +218,44 @@ class RLEWavelet {
     }
   }
 
+  // head_[pos] through Wavelet::Iterator, which every head type has.
+  uint64_t headValue(size_t pos) const {
+    typename Wavelet::Iterator it(head_);
+    for (;;) {
+      bool b = it.accessRank(pos, &pos);
+      if (it.isLeaf()) return b ? it.splitValue() : it.splitValue() - 1;
+      it = it.child(b);
+    }
+  }
+
+  // Total length of the runs [pl, pr) with heads in [lo, hi], it must
+  // overlap [lo, hi].
+  size_t countRuns(typename Wavelet::Iterator it, size_t pl, size_t pr,
+                   uint64_t lo, uint64_t hi) const {
+    size_t l1 = it.rank(pl, 1);
+    size_t r1 = it.rank(pr, 1);
+    size_t l0 = pl - l1;
+    size_t r0 = pr - r1;
+    uint64_t split = it.splitValue();
+    size_t ret = 0;
+    if (it.isLeaf()) {
+      if (lo < split && l0 < r0) {
+        ret += runRank(split - 1, r0) - runRank(split - 1, l0);
+      }
+      if (hi >= split && l1 < r1) {
+        ret += runRank(split, r1) - runRank(split, l1);
+      }
+      return ret;
+    }
+    if (lo < split && l0 < r0) {
+      ret += countRuns(it.child(0), l0, r0, lo, hi);
+    }
+    if (hi >= split && l1 < r1) {
+      ret += countRuns(it.child(1), l1, r1, lo, hi);
+    }
+    return ret;
+  }
+
   size_t runRank(uint64_t x, size_t runs) const {
     if (runs == 0) return 0;
     size_t num_rank = num_rank_.select1(x+1) - 1 ;
@@ -43,6 +43,12 @@ class RRRBitVector {
     if (!b) return i - r;
     return r;
   }
+  // Returns the bit at i and sets *rank = rank(i, bit).
+  bool accessRank(size_t i, size_t* rank) const {
+    bool b = vec_[i];
+    *rank = this->rank(i, b);
+    return b;
+  }
   size_t select(size_t i, bool b) const {
     if (i == 0) return 0;
     if (b) return select1_(i) + 1;
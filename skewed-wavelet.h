@@ -4,6 +4,8 @@
 #include "fast-bit-vector.h"
 #include "balanced-wavelet.h"
 #include <stdint.h>
+#include <algorithm>
+#include <thread>
 #include <vector>
 
 template<typename BitVector = FastBitVector>
@@ -106,6 +108,139 @@ class SkewedWavelet {
     pos = wt_pick_[lvl].rank(pos, 1);
     return ret + wt_[lvl].rankLE(pos, fixed);
   }
+  // Number of values in [lo, hi] in positions [l, r). The spine ranks
+  // are shared by both boundaries, and each level overlapping [lo, hi]
+  // counts its part with BalancedWavelet::countRange.
+  size_t countRange(size_t l, size_t r, int64_t lo, int64_t hi) const {
+    size_t ret = 0;
+    int64_t level_start = 0;
+    int64_t level_size = StartSize;
+    for (int lvl = 0; lvl < MaxLevel && l < r; ++lvl) {
+      if (level_start > hi) break;
+      size_t nl = wt_pick_[lvl].rank(l, 1);
+      size_t nr = wt_pick_[lvl].rank(r, 1);
+      int64_t level_end = level_start + level_size - 1;
+      if (lo <= level_end && nl < nr) {
+        ret += wt_[lvl].countRange(nl, nr,
+                                   std::max(lo, level_start) - level_start,
+                                   std::min(hi, level_end) - level_start);
+      }
+      l -= nl;
+      r -= nr;
+      level_start += level_size;
+      level_size *= 2;
+    }
+    return ret;
+  }
+  // Sets *value to the smallest value >= x in positions [l, r). Returns
+  // false if there is none. Walks down the spine and asks the levels from
+  // the one holding x upwards, the first hit is the answer.
+  bool rangeNextValue(size_t l, size_t r, int64_t x, int64_t* value) const {
+    int64_t level_start = 0;
+    for (int lvl = 0; lvl < MaxLevel && l < r; ++lvl) {
+      int64_t level_end = level_start + (int64_t(StartSize) << lvl) - 1;
+      size_t nl = wt_pick_[lvl].rank(l, 1);
+      size_t nr = wt_pick_[lvl].rank(r, 1);
+      uint64_t v;
+      if (x <= level_end && nl < nr &&
+          wt_[lvl].rangeNextValue(nl, nr, std::max(x, level_start) -
+                                  level_start, &v)) {
+        *value = level_start + v;
+        return true;
+      }
+      l -= nl;
+      r -= nr;
+      level_start = level_end + 1;
+    }
+    return false;
+  }
+
+  // Sets *value to the largest value <= x in positions [l, r). Returns
+  // false if there is none. Walks down the spine to the level holding x,
+  // then asks the levels from there back to the top.
+  bool rangePrevValue(size_t l, size_t r, int64_t x, int64_t* value) const {
+    size_t begin[MaxLevel], end[MaxLevel];
+    int64_t level_start = 0;
+    int last = -1;
+    for (int lvl = 0; lvl < MaxLevel && l < r && level_start <= x; ++lvl) {
+      begin[lvl] = wt_pick_[lvl].rank(l, 1);
+      end[lvl] = wt_pick_[lvl].rank(r, 1);
+      l -= begin[lvl];
+      r -= end[lvl];
+      level_start += int64_t(StartSize) << lvl;
+      last = lvl;
+    }
+    for (int lvl = last; lvl >= 0; --lvl) {
+      level_start -= int64_t(StartSize) << lvl;
+      int64_t level_end = level_start + (int64_t(StartSize) << lvl) - 1;
+      uint64_t v;
+      if (begin[lvl] < end[lvl] &&
+          wt_[lvl].rangePrevValue(begin[lvl], end[lvl],
+                                  std::min(x, level_end) - level_start, &v)) {
+        *value = level_start + v;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  struct Query {
+    size_t pos;
+    int64_t value;
+  };
+
+  // out[i] = rankLE(queries[i].pos, queries[i].value) for i < n. The spine
+  // is walked one level at a time over the queries sorted by position, and
+  // the queries reaching each level are answered with one
+  // BalancedWavelet::rankLEBatch, which may use up to threads threads.
+  void rankLEBatch(const Query* queries, size_t n, size_t* out,
+                   unsigned threads = std::thread::hardware_concurrency())
+      const {
+    typedef typename BalancedWavelet<BitVector>::Query LevelQuery;
+    std::vector<size_t> active(n);
+    std::vector<size_t> pos(n);
+    std::vector<int> level(n);
+    std::vector<int64_t> fixed(n);
+    for (size_t i = 0; i < n; ++i) {
+      active[i] = i;
+      pos[i] = queries[i].pos;
+      out[i] = 0;
+      level[i] = Level(queries[i].value, &fixed[i]);
+    }
+    std::sort(active.begin(), active.end(), [&](size_t a, size_t b) {
+      return pos[a] < pos[b];
+    });
+    // Positions stay sorted, as rank is monotone.
+    std::vector<size_t> next, done;
+    std::vector<LevelQuery> batch;
+    std::vector<size_t> result;
+    for (int lvl = 0; lvl < MaxLevel && !active.empty(); ++lvl) {
+      next.clear();
+      done.clear();
+      batch.clear();
+      for (size_t i : active) {
+        if (level[i] == lvl) {
+          batch.push_back(LevelQuery{wt_pick_[lvl].rank(pos[i], 1),
+                                     uint64_t(fixed[i])});
+          done.push_back(i);
+        } else {
+          size_t np = wt_pick_[lvl].rank(pos[i], 0);
+          out[i] += pos[i] - np;
+          pos[i] = np;
+          next.push_back(i);
+        }
+      }
+      if (!batch.empty()) {
+        result.resize(batch.size());
+        wt_[lvl].rankLEBatch(&batch[0], batch.size(), &result[0], threads);
+        for (size_t j = 0; j < done.size(); ++j) {
+          out[done[j]] += result[j];
+        }
+      }
+      active.swap(next);
+    }
+  }
+
   size_t size() const {
     return wt_pick_[0].size();
   }
@@ -159,6 +294,14 @@ class SkewedWavelet {
         return balanced_it.rank(pos, bit);
       }
     }
+    // Returns the bit at pos and sets *rank = rank(pos, bit).
+    bool accessRank(size_t pos, size_t* rank) const {
+      if (spine) {
+        return !wt->wt_pick_[level].accessRank(pos, rank);
+      } else {
+        return balanced_it.accessRank(pos, rank);
+      }
+    }
     size_t select(size_t idx, bool bit) const {
       if (spine) {
         return wt->wt_pick_[level].select(idx, !bit);
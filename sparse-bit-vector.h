@@ -75,6 +75,30 @@ class SparseBitVector {
     return bit ? x : pos - x;
   }
 
+  // Returns the bit at pos and sets *rank = rank(pos, bit).
+  // operator[] and rank share the same scan over the bucket of pos.
+  bool accessRank(size_t pos, size_t* rank) const {
+    if (size_ == 0) {
+      *rank = 0;
+      return 0;
+    }
+    uint64_t mask = (1LL << w_) - 1;
+    size_t high = pos >> w_;
+    size_t low = pos & mask;
+    size_t y = high_bits_.select(high, 0);
+    size_t x = y - high;
+    bool bit = 0;
+    for (;high_bits_[y] == 1; x++, y++) {
+      size_t l = this->low(x);
+      if (l >= low) {
+        bit = l == low;
+        break;
+      }
+    }
+    *rank = bit ? x : pos - x;
+    return bit;
+  }
+
   // Compatibility function, for b = 0 binary search is used.
   size_t select(size_t rnk, bool b) const {
     if (rnk == 0) return 0;
@@ -149,7 +173,7 @@ class SparseBitVector {
       high_bits[high + i] = 1;
       ++i;
     }
-    high_bits_ = FastBitVector(high_bits);
+    high_bits_ = BasicFastBitVector<SelectOnlySampling>(high_bits);
   }
   int low(size_t i) const {
     return low_arr_.get(i);
@@ -158,7 +182,8 @@ class SparseBitVector {
   size_t pop_;
   size_t size_;
   IntArray low_arr_;
-  FastBitVector high_bits_;
+  // Only select is used, so no relative rank counters are stored.
+  BasicFastBitVector<SelectOnlySampling> high_bits_;
 
  public:
   friend void swap(SparseBitVector& a, SparseBitVector& b) {
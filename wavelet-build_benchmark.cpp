@@ -0,0 +1,77 @@
+#include "balanced-wavelet.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+
+#include <sys/resource.h>
+
+using namespace std;
+
+// Usage: wavelet-build_benchmark [log_size] [max_threads]
+
+std::vector<uint32_t> Values(int log_size) {
+  const size_t size = size_t(1) << log_size;
+  std::mt19937_64 mt(0);
+  std::vector<uint32_t> v(size);
+  for (size_t i = 0; i < size; ++i) {
+    v[i] = mt() % (1 << 20);
+  }
+  return v;
+}
+
+// Peak resident memory of the process so far.
+size_t PeakMB() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024;
+}
+
+// Builds in place with size / 64 values of scratch. Runs first, so that the
+// peak memory reported is its own.
+void BuildInPlace(int log_size) {
+  using namespace std::chrono;
+  std::vector<uint32_t> v = Values(log_size);
+  std::cout << "BalancedWavelet in place build, 2^" << log_size
+            << " values (" << v.size() * sizeof(v[0]) / (1 << 20)
+            << "MB):\n";
+  std::chrono::high_resolution_clock clock;
+  auto start = clock.now();
+  BalancedWavelet<> wt(&v[0], v.size(), 1, v.size() / 64);
+  auto end = clock.now();
+  double ms = duration_cast<milliseconds>(end-start).count();
+  std::cout << ms << "ms, " << ms * 1e6 / v.size() << "ns/value, tree "
+            << wt.bitSize() / 8 / (1 << 20) << "MB, peak " << PeakMB()
+            << "MB\n";
+}
+
+// Builds over 2^log_size values with 1, 2, 4, ... threads.
+void Build(int log_size, unsigned max_threads) {
+  using namespace std::chrono;
+  std::vector<uint32_t> v = Values(log_size);
+  const size_t size = v.size();
+  std::cout << "BalancedWavelet build, 2^" << log_size << " values:\n";
+  double base = 0;
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    std::vector<uint32_t> c = v;
+    std::chrono::high_resolution_clock clock;
+    auto start = clock.now();
+    BalancedWavelet<> wt(&c[0], c.size(), threads);
+    auto end = clock.now();
+    double ms = duration_cast<milliseconds>(end-start).count();
+    if (threads == 1) base = ms;
+    std::cout << threads << " threads: " << ms << "ms, "
+              << ms * 1e6 / size << "ns/value, speedup "
+              << base / ms << "x, peak " << PeakMB() << "MB\n";
+  }
+}
+
+int main(int argc, char** argv) {
+  int log_size = argc > 1 ? atoi(argv[1]) : 26;
+  unsigned max_threads = argc > 2 ? atoi(argv[2])
+                                  : std::thread::hardware_concurrency();
+  BuildInPlace(log_size);
+  Build(log_size, std::max(1u, max_threads));
+}
@@ -0,0 +1,311 @@
+#ifndef WAVELET_MATRIX_H
+#define WAVELET_MATRIX_H
+
+#include "fast-bit-vector.h"
+#include <stdint.h>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <stdexcept>
+
+// Wavelet matrix from F. Claude, G. Navarro: 'The Wavelet Matrix'.
+// Level l stores bit (bits - 1 - l) of every value, in the order of the
+// values stably sorted by their bits above that one, zeros first. Nodes
+// are not stored, so traversing down needs no node offsets: a position
+// moves to rank(pos, 0) or zeros_[l] + rank(pos, 1) on the next level.
+//
+// Bits = 0 takes just enough bits for the largest value. Otherwise the
+// width is a compile time constant, so the compiler can unroll the level
+// loops, and constructing from a value >= 2^Bits throws
+// std::invalid_argument.
+template<typename BitVector = FastBitVector, int Bits = 0>
+class WaveletMatrix {
+  static_assert(Bits >= 0 && Bits <= 64, "Bits must be in [0, 64]");
+ public:
+  static const size_t npos = -1;
+
+  template<typename IntType>
+  WaveletMatrix(std::vector<IntType> && vec)
+      : WaveletMatrix(&vec[0], vec.size()) { }
+
+  // Reorders vec.
+  template<typename IntType>
+  WaveletMatrix(IntType* vec, size_t size)
+      : size_(size),
+        bits_(Bits) {
+    if (size == 0) return;
+    if (Bits == 0) {
+      IntType max = *std::max_element(&vec[0], &vec[size]);
+      bits_ = 1 + log2(max);
+      if (bits_ <= 0) bits_ = 1;
+    } else if (std::any_of(&vec[0], &vec[size], [&](IntType x) {
+                 return !inRange(x);
+               })) {
+      throw std::invalid_argument("WaveletMatrix: value >= 2^Bits");
+    }
+    levels_.reserve(bits_);
+    std::vector<bool> level(size_);
+    for (int l = 0; l < bits_; ++l) {
+      uint64_t bit = 1ull << (bits_ - l - 1);
+      size_t zeros = 0;
+      for (size_t i = 0; i < size_; ++i) {
+        level[i] = (vec[i] & bit) != 0;
+        zeros += !level[i];
+      }
+      levels_.emplace_back(level);
+      zeros_.push_back(zeros);
+      if (bit == 1) break;
+      std::stable_partition(&vec[0], &vec[size_], [&](IntType x) -> bool {
+        return (x & bit) == 0;
+      });
+    }
+  }
+
+  template<typename It>
+  WaveletMatrix(It begin, It end)
+       : WaveletMatrix(std::vector<
+                       typename std::iterator_traits<It>::value_type
+                       >(begin, end)) {
+  }
+
+  WaveletMatrix(const WaveletMatrix& o) = delete;
+
+  WaveletMatrix() {
+    size_ = 0;
+    bits_ = Bits;
+  }
+  WaveletMatrix(WaveletMatrix&& o)
+      : levels_(std::move(o.levels_)),
+        zeros_(std::move(o.zeros_)),
+        size_(o.size_),
+        bits_(o.bits_) { }
+
+  const WaveletMatrix& operator=(WaveletMatrix&& o) {
+    levels_ = std::move(o.levels_);
+    zeros_ = std::move(o.zeros_);
+    size_ = o.size_;
+    bits_ = o.bits_;
+    o.size_ = 0;
+    return *this;
+  }
+
+  // Node iterator with the interface of BalancedWavelet::Iterator.
+  // A node is a range of positions on its level.
+  class Iterator {
+   public:
+    Iterator(const WaveletMatrix& matrix)
+        : high_bits(0),
+          begin(0),
+          len(matrix.size_),
+          level(0),
+          bit(matrix.bits() - 1),
+          begin_rank(0),
+          end_rank(matrix.size_ == 0 ? 0 : matrix.levels_[0].rank(len, 1)),
+          wm(&matrix)
+    {}
+    // Null constructor - only operator= is supported.
+    Iterator()
+        : high_bits(0),
+          begin(0),
+          len(0),
+          level(0),
+          bit(0),
+          begin_rank(0),
+          end_rank(0),
+          wm(nullptr)
+    {}
+
+    uint64_t splitValue() const {
+      return high_bits + (1LL << bit);
+    }
+
+    bool isLeaf() const {
+      return bit == 0;
+    }
+
+    Iterator child(bool right) const {
+      return Iterator(*this, right);
+    }
+
+    bool operator[](size_t i) const {
+      return vec()[begin + i];
+    }
+
+    size_t rank(size_t pos, bool bit) const {
+      assert(pos <= len);
+      size_t orank = bit ? begin_rank : begin - begin_rank;
+      return vec().rank(begin + pos, bit) - orank;
+    }
+    // Returns the bit at pos and sets *rank = rank(pos, bit).
+    bool accessRank(size_t pos, size_t* rank) const {
+      assert(pos <= len);
+      bool bit = vec().accessRank(begin + pos, rank);
+      *rank -= bit ? begin_rank : begin - begin_rank;
+      return bit;
+    }
+    size_t select(size_t idx, bool bit) const {
+      size_t orank = bit ? begin_rank : begin - begin_rank;
+      return vec().select(idx + orank, bit) - begin;
+    }
+    size_t count() const {
+      return len;
+    }
+   private:
+    Iterator(const Iterator& parent, bool right) : wm(parent.wm) {
+      level = parent.level + 1;
+      bit = parent.bit - 1;
+      if (right) {
+        begin = wm->zeros_[parent.level] + parent.begin_rank;
+        len = parent.end_rank;
+        high_bits = parent.high_bits + (1LL << parent.bit);
+      } else {
+        begin = parent.begin - parent.begin_rank;
+        len = parent.len - parent.end_rank;
+        high_bits = parent.high_bits;
+      }
+      begin_rank = vec().rank(begin, 1);
+      end_rank = vec().rank(begin + len, 1) - begin_rank;
+    }
+    const BitVector& vec() const {
+      return wm->levels_[level];
+    }
+    uint64_t high_bits;
+    size_t begin;
+    size_t len;
+    int level;
+    int bit;
+    size_t begin_rank;
+    size_t end_rank;
+    const WaveletMatrix* wm;
+    friend class WaveletMatrix;
+  };
+
+  size_t rank(size_t pos, uint64_t value) const {
+    assert(pos <= size());
+    if (!inRange(value) || size_ == 0) return 0;
+    size_t begin = 0;
+    for (int l = 0; l < bits(); ++l) {
+      bool bit = (value >> (bits() - l - 1)) & 1;
+      begin = down(l, begin, bit);
+      pos = down(l, pos, bit);
+    }
+    return pos - begin;
+  }
+
+  size_t rankLE(size_t pos, uint64_t value) const {
+    assert(pos <= size());
+    if (!inRange(value) || size_ == 0) return pos;
+    size_t ret = 0;
+    size_t begin = 0;
+    for (int l = 0; l < bits(); ++l) {
+      bool bit = (value >> (bits() - l - 1)) & 1;
+      size_t nbegin = down(l, begin, bit);
+      size_t npos = down(l, pos, bit);
+      if (bit) {
+        // Values with a zero here are smaller.
+        ret += (pos - begin) - (npos - nbegin);
+      }
+      begin = nbegin;
+      pos = npos;
+    }
+    return ret + pos - begin;
+  }
+
+  uint64_t operator[](size_t i) const {
+    uint64_t value = 0;
+    for (int l = 0; l < bits(); ++l) {
+      size_t r;
+      bool bit = levels_[l].accessRank(i, &r);
+      i = bit ? zeros_[l] + r : r;
+      value = (value << 1) | bit;
+    }
+    return value;
+  }
+
+  // Returns smallest position pos so that rank(pos, value) == rank.
+  size_t select(size_t rank, uint64_t value) const {
+    if (rank == 0 || size_ == 0) return 0;
+    if (!inRange(value)) return 0;
+    // Start of the node of value on each level.
+    size_t begin[MaxBits + 1];
+    begin[0] = 0;
+    for (int l = 0; l < bits(); ++l) {
+      bool bit = (value >> (bits() - l - 1)) & 1;
+      begin[l + 1] = down(l, begin[l], bit);
+    }
+    // Walk up from the rank:th occurrence on the last level.
+    size_t pos = begin[bits()] + rank;
+    for (int l = bits() - 1; l >= 0; --l) {
+      bool bit = (value >> (bits() - l - 1)) & 1;
+      size_t idx = bit ? pos - zeros_[l] : pos;
+      pos = levels_[l].select(idx, bit);
+    }
+    return pos;
+  }
+
+  // Returns the k:th smallest value, counting from 0, in positions [l, r).
+  uint64_t quantile(size_t l, size_t r, size_t k) const {
+    assert(l <= r && r <= size());
+    assert(k < r - l);
+    uint64_t value = 0;
+    for (int lev = 0; lev < bits(); ++lev) {
+      size_t zl = levels_[lev].rank(l, 0);
+      size_t zr = levels_[lev].rank(r, 0);
+      bool bit = k >= zr - zl;
+      if (bit) {
+        k -= zr - zl;
+        l = zeros_[lev] + l - zl;
+        r = zeros_[lev] + r - zr;
+      } else {
+        l = zl;
+        r = zr;
+      }
+      value = (value << 1) | bit;
+    }
+    return value;
+  }
+
+  // Lower median of positions [l, r), which must not be empty.
+  uint64_t rangeMedian(size_t l, size_t r) const {
+    return quantile(l, r, (r - l - 1) / 2);
+  }
+
+  size_t size() const {
+    return size_;
+  }
+  size_t bitSize() const {
+    size_t ret = sizeof(*this) * 8 + zeros_.size() * 64;
+    for (size_t l = 0; l < levels_.size(); ++l) {
+      ret += levels_[l].bitSize();
+    }
+    return ret;
+  }
+ private:
+  static const int MaxBits = 64;
+  // Number of levels, a constant when Bits != 0.
+  int bits() const {
+    return Bits != 0 ? Bits : bits_;
+  }
+  bool inRange(uint64_t value) const {
+    return bits() == MaxBits || value >> (bits() % MaxBits) == 0;
+  }
+  // Position of pos on level l + 1 when following bit.
+  size_t down(int l, size_t pos, bool bit) const {
+    size_t r = levels_[l].rank(pos, bit);
+    return bit ? zeros_[l] + r : r;
+  }
+
+  std::vector<BitVector> levels_;
+  // Number of zeros on each level.
+  std::vector<size_t> zeros_;
+  size_t size_;
+  int bits_;
+};
+
+// WaveletMatrix over values of exactly Bits bits.
+template<int Bits, typename BitVector = FastBitVector>
+using FixedWidthWavelet = WaveletMatrix<BitVector, Bits>;
+
+#endif
@@ -1,6 +1,11 @@
 #include "skewed-wavelet.h"
 #include "balanced-wavelet.h"
 #include "rle-wavelet.h"
+#include "wavelet-matrix.h"
+#include "multiary-wavelet.h"
+#include "huffman-wavelet.h"
+#include "dynamic-wavelet.h"
+#include "interleaved-bit-vector.h"
 
 #include <iostream>
 #include <random>
@@ -8,13 +13,12 @@
 
 using namespace std;
 
-template<typename Wt>
-void RankLE(int iters, int m, const char* name) {
-  const size_t size = 1<<20;
+const size_t size = 1<<20;
+
+// Random values in [0, 2^20) with run lengths in [1, 1024].
+std::vector<uint64_t> RunData() {
   const size_t max = 1<<20;
   const size_t max_run = 1024;
-  std::cout << name << "::rankLE(" << m << "):\n";
-  using namespace std::chrono;
   std::mt19937_64 mt(0);
   std::vector<uint64_t> v;
   while (v.size() < size) {
@@ -24,6 +28,24 @@ void RankLE(int iters, int m, const char* name) {
       v.push_back(val);
     }
   }
+  return v;
+}
+
+// BalancedWavelet with the top Levels levels in the node cache.
+template<int Levels>
+class CachedBalancedWavelet : public BalancedWavelet<> {
+ public:
+  template<typename It>
+  CachedBalancedWavelet(It begin, It end) : BalancedWavelet<>(begin, end) {
+    cacheNodes(Levels);
+  }
+};
+
+template<typename Wt>
+void RankLE(int iters, int m, const char* name) {
+  std::cout << name << "::rankLE(" << m << "):\n";
+  using namespace std::chrono;
+  std::vector<uint64_t> v = RunData();
   Wt wt(v.begin(), v.end());
   std::chrono::high_resolution_clock clock;
   auto start = clock.now();
@@ -39,10 +61,230 @@ void RankLE(int iters, int m, const char* name) {
   std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/rank\n";
 }
 
+template<typename Wt>
+void Access(int iters, const char* name) {
+  std::cout << name << "::operator[]:\n";
+  using namespace std::chrono;
+  std::vector<uint64_t> v = RunData();
+  Wt wt(v.begin(), v.end());
+  std::chrono::high_resolution_clock clock;
+  auto start = clock.now();
+  unsigned long long total = 0;
+  for (int j = 0; j < iters; ++j) {
+    total = total * 178923 + 987341;
+    total += wt[total % size];
+  }
+  std::cout << "(" << total << ")\n";
+
+  auto end = clock.now();
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/access\n";
+}
+
+template<typename Wt>
+void RangeMedian(int iters, size_t range, const char* name) {
+  std::cout << name << "::rangeMedian(" << range << "):\n";
+  using namespace std::chrono;
+  std::vector<uint64_t> v = RunData();
+  Wt wt(v.begin(), v.end());
+  std::chrono::high_resolution_clock clock;
+  auto start = clock.now();
+  unsigned long long total = 0;
+  for (int j = 0; j < iters; ++j) {
+    total = total * 178923 + 987341;
+    size_t l = total % (size - range);
+    total += wt.rangeMedian(l, l + range);
+  }
+  std::cout << "(" << total << ")\n";
+
+  auto end = clock.now();
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/query\n";
+}
+
+// extract of a window against operator[] for each position.
+template<typename Wt>
+void Extract(int iters, size_t range, const char* name) {
+  using namespace std::chrono;
+  std::vector<uint64_t> v = RunData();
+  Wt wt(v.begin(), v.end());
+  std::vector<uint64_t> out(range);
+  std::chrono::high_resolution_clock clock;
+  for (int access = 0; access < 2; ++access) {
+    std::cout << name << (access ? "::operator[](" : "::extract(")
+              << range << "):\n";
+    auto start = clock.now();
+    unsigned long long total = 0;
+    for (int j = 0; j < iters; ++j) {
+      total = total * 178923 + 987341;
+      size_t l = total % (size - range);
+      if (access) {
+        for (size_t i = 0; i < range; ++i) out[i] = wt[l + i];
+      } else {
+        wt.extract(l, l + range, &out[0]);
+      }
+      total += out[total % range];
+    }
+    std::cout << "(" << total << ")\n";
+
+    auto end = clock.now();
+    std::cout << duration_cast<nanoseconds>(end-start).count()/iters/range
+              << "ns/value\n";
+  }
+}
+
+// countRange against the four rankLE calls it replaces.
+template<typename Wt>
+void CountRange(int iters, const char* name) {
+  using namespace std::chrono;
+  std::vector<uint64_t> v = RunData();
+  Wt wt(v.begin(), v.end());
+  const size_t range = 1<<16;
+  const uint64_t width = 1<<16;
+  std::chrono::high_resolution_clock clock;
+  for (int four = 0; four < 2; ++four) {
+    std::cout << name << (four ? "::rankLE x4:\n" : "::countRange:\n");
+    auto start = clock.now();
+    unsigned long long total = 0;
+    for (int j = 0; j < iters; ++j) {
+      total = total * 178923 + 987341;
+      size_t l = total % (size - range);
+      uint64_t lo = 1 + total % ((1<<20) - width);
+      uint64_t hi = lo + width;
+      if (four) {
+        total += wt.rankLE(l + range, hi) - wt.rankLE(l + range, lo - 1) -
+                 (wt.rankLE(l, hi) - wt.rankLE(l, lo - 1));
+      } else {
+        total += wt.countRange(l, l + range, lo, hi);
+      }
+    }
+    std::cout << "(" << total << ")\n";
+
+    auto end = clock.now();
+    std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/query\n";
+  }
+}
+
+// rankLEBatch over n random queries against a loop of rankLE calls.
+template<typename Wt>
+void RankLEBatch(size_t n, const char* name) {
+  using namespace std::chrono;
+  std::vector<uint64_t> v = RunData();
+  Wt wt(v.begin(), v.end());
+  std::vector<typename Wt::Query> queries(n);
+  unsigned long long seed = 0;
+  for (auto& q : queries) {
+    seed = seed * 178923 + 987341;
+    q.pos = seed % size;
+    q.value = (seed >> 20) % (1<<20);
+  }
+  std::vector<size_t> out(n);
+  std::chrono::high_resolution_clock clock;
+  for (int batch = 0; batch < 2; ++batch) {
+    std::cout << name << (batch ? "::rankLEBatch:\n" : "::rankLE loop:\n");
+    auto start = clock.now();
+    if (batch) {
+      wt.rankLEBatch(&queries[0], n, &out[0]);
+    } else {
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = wt.rankLE(queries[i].pos, queries[i].value);
+      }
+    }
+    unsigned long long total = 0;
+    for (size_t i = 0; i < n; ++i) total = total * 31 + out[i];
+    std::cout << "(" << total << ")\n";
+
+    auto end = clock.now();
+    std::cout << duration_cast<nanoseconds>(end-start).count()/n << "ns/rank\n";
+  }
+}
+
+// Mix of updates and rankLE queries on DynamicWavelet, updates percent of
+// the operations. Updates cycle through insert, set and erase, so the
+// size stays around size.
+void DynamicMixed(int iters, int updates) {
+  std::cout << "DynamicWavelet " << updates << "% updates:\n";
+  using namespace std::chrono;
+  std::vector<uint64_t> v = RunData();
+  DynamicWavelet<> wt(v.begin(), v.end(), 20);
+  std::chrono::high_resolution_clock clock;
+  auto start = clock.now();
+  unsigned long long total = 0;
+  int update = 0;
+  for (int j = 0; j < iters; ++j) {
+    total = total * 178923 + 987341;
+    size_t pos = total % wt.size();
+    if (int(total % 100) < updates) {
+      uint64_t value = (total >> 20) % (1<<20);
+      switch (update++ % 3) {
+        case 0: wt.insert(pos, value); break;
+        case 1: wt.set(pos, value); break;
+        case 2: total += wt.erase(pos); break;
+      }
+    } else {
+      total += wt.rankLE(pos, (total >> 20) % (1<<20));
+    }
+  }
+  std::cout << "(" << total << ")\n";
+
+  auto end = clock.now();
+  std::cout << duration_cast<nanoseconds>(end-start).count()/iters << "ns/op\n";
+}
+
 int main() {
   int iters = 100000;
+  Access<BalancedWavelet<>>(iters, "BalancedWavelet");
+  Access<CachedBalancedWavelet<10>>(iters, "BalancedWavelet cacheNodes(10)");
+  Access<CachedBalancedWavelet<20>>(iters, "BalancedWavelet cacheNodes(20)");
+  Access<MultiaryWavelet<4>>(iters, "MultiaryWavelet<4>");
+  Access<MultiaryWavelet<16>>(iters, "MultiaryWavelet<16>");
+  Access<HuffmanWavelet<>>(iters, "HuffmanWavelet");
+  Access<FixedWidthWavelet<20>>(iters, "FixedWidthWavelet<20>");
+  Access<FixedWidthWavelet<32>>(iters, "FixedWidthWavelet<32>");
+  Access<DynamicWavelet<>>(iters, "DynamicWavelet");
+  Access<BalancedWavelet<InterleavedBitVector>>(iters, "BalancedWavelet<InterleavedBitVector>");
+  Access<WaveletMatrix<>>(iters, "WaveletMatrix");
+  Access<RLEWavelet<BalancedWavelet<>>>(iters, "RLEWavelet<BalancedWavelet>");
+  Access<RLEWavelet<WaveletMatrix<>>>(iters, "RLEWavelet<WaveletMatrix>");
+  cout << endl;
+  RangeMedian<BalancedWavelet<>>(iters, 1<<10, "BalancedWavelet");
+  RangeMedian<BalancedWavelet<>>(iters, 1<<16, "BalancedWavelet");
+  RangeMedian<WaveletMatrix<>>(iters, 1<<10, "WaveletMatrix");
+  RangeMedian<WaveletMatrix<>>(iters, 1<<16, "WaveletMatrix");
+  cout << endl;
+  Extract<BalancedWavelet<>>(100, 1<<16, "BalancedWavelet");
+  Extract<RLEWavelet<BalancedWavelet<>>>(100, 1<<16, "RLEWavelet<BalancedWavelet>");
+  cout << endl;
+  RankLEBatch<BalancedWavelet<>>(1000000, "BalancedWavelet");
+  RankLEBatch<SkewedWavelet<>>(1000000, "SkewedWavelet");
+  cout << endl;
+  DynamicMixed(iters, 0);
+  DynamicMixed(iters, 10);
+  DynamicMixed(iters, 50);
+  DynamicMixed(iters, 100);
+  cout << endl;
+  CountRange<BalancedWavelet<>>(iters, "BalancedWavelet");
+  CountRange<SkewedWavelet<>>(iters, "SkewedWavelet");
+  CountRange<RLEWavelet<BalancedWavelet<>>>(iters / 10, "RLEWavelet<BalancedWavelet>");
+  cout << endl;
   RankLE<BalancedWavelet<>>(iters, 32, "BalancedWavelet");
   RankLE<BalancedWavelet<>>(iters, 1<<10, "BalancedWavelet");
+  RankLE<CachedBalancedWavelet<10>>(iters, 32, "BalancedWavelet cacheNodes(10)");
+  RankLE<CachedBalancedWavelet<10>>(iters, 1<<10, "BalancedWavelet cacheNodes(10)");
+  RankLE<CachedBalancedWavelet<20>>(iters, 32, "BalancedWavelet cacheNodes(20)");
+  RankLE<CachedBalancedWavelet<20>>(iters, 1<<10, "BalancedWavelet cacheNodes(20)");
+  cout << endl;
+  RankLE<BalancedWavelet<InterleavedBitVector>>(iters, 32, "BalancedWavelet<InterleavedBitVector>");
+  RankLE<BalancedWavelet<InterleavedBitVector>>(iters, 1<<10, "BalancedWavelet<InterleavedBitVector>");
+  cout << endl;
+  RankLE<WaveletMatrix<>>(iters, 32, "WaveletMatrix");
+  RankLE<WaveletMatrix<>>(iters, 1<<10, "WaveletMatrix");
+  RankLE<FixedWidthWavelet<20>>(iters, 32, "FixedWidthWavelet<20>");
+  RankLE<FixedWidthWavelet<20>>(iters, 1<<10, "FixedWidthWavelet<20>");
+  RankLE<FixedWidthWavelet<32>>(iters, 32, "FixedWidthWavelet<32>");
+  RankLE<FixedWidthWavelet<32>>(iters, 1<<10, "FixedWidthWavelet<32>");
+  RankLE<MultiaryWavelet<4>>(iters, 32, "MultiaryWavelet<4>");
+  RankLE<MultiaryWavelet<4>>(iters, 1<<10, "MultiaryWavelet<4>");
+  RankLE<MultiaryWavelet<16>>(iters, 32, "MultiaryWavelet<16>");
+  RankLE<MultiaryWavelet<16>>(iters, 1<<10, "MultiaryWavelet<16>");
   cout << endl;
   RankLE<SkewedWavelet<>>(iters, 32, "SkewedWavelet");
   RankLE<SkewedWavelet<>>(iters, 1<<10, "SkewedWavelet");
@@ -52,4 +294,7 @@ int main() {
   cout << endl;
   RankLE<RLEWavelet<SkewedWavelet<>>>(iters, 32, "RLEWavelet<SkewedWavelet>");
   RankLE<RLEWavelet<SkewedWavelet<>>>(iters, 1<<10, "RLEWavelet<SkewedWavelet>");
+  cout << endl;
+  RankLE<RLEWavelet<WaveletMatrix<>>>(iters, 32, "RLEWavelet<WaveletMatrix>");
+  RankLE<RLEWavelet<WaveletMatrix<>>>(iters, 1<<10, "RLEWavelet<WaveletMatrix>");
 }
@@ -1,11 +1,24 @@
 #include "balanced-wavelet.h"
 #include "skewed-wavelet.h"
 #include "rle-wavelet.h"
+#include "wavelet-matrix.h"
+#include "multiary-wavelet.h"
+#include "huffman-wavelet.h"
+#include "dynamic-wavelet.h"
+#include "balanced-wavelet-builder.h"
 
+#include "dense-select-bit-vector.h"
+#include "interleaved-bit-vector.h"
 #include "rrr-bit-vector.h"
 
 #include <gtest/gtest.h>
 #include <iostream>
+#include <algorithm>
+#include <random>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
 #include <vector>
 using namespace std;
 
@@ -29,6 +42,611 @@ TEST(BalancedWaveletTest, Indexing) {
   }
 }
 
+TEST(BalancedWaveletTest, ParallelBuild) {
+  std::mt19937_64 mt(0);
+  // Large enough for several threads.
+  vector<uint32_t> v;
+  for (int i = 0; i < 300000; ++i) {
+    v.push_back(mt() % (i % 7 == 0 ? 1000 : 20));
+  }
+  vector<uint32_t> a = v, b = v;
+  BalancedWavelet<> serial(&a[0], a.size(), 1);
+  BalancedWavelet<> parallel(&b[0], b.size(), 4);
+  ASSERT_EQ(serial.bitSize(), parallel.bitSize());
+  for (size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(v[i], serial[i]) << " i = " << i;
+    ASSERT_EQ(v[i], parallel[i]) << " i = " << i;
+  }
+  for (int j = 0; j < 1000; ++j) {
+    size_t pos = mt() % (v.size() + 1);
+    uint64_t value = mt() % 1000;
+    ASSERT_EQ(serial.rankLE(pos, value), parallel.rankLE(pos, value));
+  }
+}
+
+TEST(BalancedWaveletTest, InPlaceBuild) {
+  std::mt19937_64 mt(0);
+  vector<uint32_t> v;
+  for (int i = 0; i < 100000; ++i) {
+    v.push_back(mt() % (i % 7 == 0 ? 1000 : 20));
+  }
+  vector<uint32_t> a = v;
+  BalancedWavelet<> full(&a[0], a.size(), 1);
+  for (size_t scratch : {0, 1, 1000}) {
+    vector<uint32_t> b = v;
+    BalancedWavelet<> wt(&b[0], b.size(), 1, scratch);
+    ASSERT_EQ(full.bitSize(), wt.bitSize());
+    for (size_t i = 0; i < v.size(); ++i) {
+      ASSERT_EQ(v[i], wt[i]) << " i = " << i << " scratch = " << scratch;
+    }
+  }
+}
+
+TEST(BalancedWaveletTest, BuildFile) {
+  std::mt19937_64 mt(0);
+  vector<uint32_t> v;
+  for (int i = 0; i < 50000; ++i) {
+    v.push_back(mt() % (i % 3 == 0 ? 1000 : 30));
+  }
+  std::string input = ::testing::TempDir() + "wavelet_test.in";
+  std::string expected = ::testing::TempDir() + "wavelet_test.expected";
+  std::string output = ::testing::TempDir() + "wavelet_test.out";
+  FILE* f = fopen(input.c_str(), "wb");
+  ASSERT_TRUE(f != nullptr);
+  fwrite(&v[0], sizeof(v[0]), v.size(), f);
+  fclose(f);
+  BalancedWavelet<> wt(v.begin(), v.end());
+  ASSERT_TRUE(wt.save(expected.c_str()));
+  // Small enough to spill.
+  BalancedWaveletFileBuilder builder(4096);
+  ASSERT_TRUE(builder.build<uint32_t>(input.c_str(), output.c_str()));
+
+  std::ifstream a(expected.c_str(), std::ios::binary);
+  std::ifstream b(output.c_str(), std::ios::binary);
+  std::string expected_bytes((std::istreambuf_iterator<char>(a)),
+                             std::istreambuf_iterator<char>());
+  std::string output_bytes((std::istreambuf_iterator<char>(b)),
+                           std::istreambuf_iterator<char>());
+  EXPECT_TRUE(expected_bytes == output_bytes);
+
+  BalancedWavelet<FastBitVectorView> mapped;
+  ASSERT_TRUE(mapped.open(output.c_str()));
+  ASSERT_EQ(v.size(), mapped.size());
+  for (size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(v[i], mapped[i]) << " i = " << i;
+  }
+  for (int j = 0; j < 1000; ++j) {
+    size_t pos = mt() % (v.size() + 1);
+    uint64_t value = mt() % 1000;
+    ASSERT_EQ(wt.rankLE(pos, value), mapped.rankLE(pos, value));
+  }
+  remove(input.c_str());
+  remove(expected.c_str());
+  remove(output.c_str());
+}
+
+TEST(BalancedWaveletTest, BuildFileReadError) {
+  // Reading a directory fails with an error rather than at end of file.
+  std::string output = ::testing::TempDir() + "wavelet_test.out";
+  BalancedWaveletFileBuilder builder(4096);
+  EXPECT_FALSE(builder.build<uint32_t>(::testing::TempDir().c_str(),
+                                       output.c_str()));
+  remove(output.c_str());
+}
+
+TEST(BalancedWaveletTest, NodeCache) {
+  std::mt19937_64 mt(0);
+  vector<int> v;
+  for (int i = 0; i < 5000; ++i) {
+    // Leaves some nodes empty.
+    v.push_back(mt() % (i % 3 == 0 ? 1000 : 100));
+  }
+  BalancedWavelet<> plain(v.begin(), v.end());
+  BalancedWavelet<> wt(v.begin(), v.end());
+  for (int levels : {1, 3, 9, 10, 64, 0}) {
+    wt.cacheNodes(levels);
+    for (size_t i = 0; i < v.size(); ++i) {
+      ASSERT_EQ(v[i], wt[i]) << " i = " << i << " levels = " << levels;
+    }
+    for (int j = 0; j < 1000; ++j) {
+      size_t pos = mt() % (v.size() + 1);
+      uint64_t value = mt() % 1024;
+      ASSERT_EQ(plain.rank(pos, value), wt.rank(pos, value)) << levels;
+      ASSERT_EQ(plain.rankLE(pos, value), wt.rankLE(pos, value)) << levels;
+    }
+    for (int value = 0; value < 1000; value += 7) {
+      size_t count = plain.rank(v.size(), value);
+      for (size_t r = 1; r <= count; ++r) {
+        ASSERT_EQ(plain.select(r, value), wt.select(r, value)) << levels;
+      }
+    }
+  }
+  // 64 levels are clamped to what 100 values justify.
+  vector<uint64_t> wide;
+  for (int i = 0; i < 100; ++i) {
+    wide.push_back(i % 2 ? mt() : mt() % 100);
+  }
+  BalancedWavelet<> wide_plain(wide.begin(), wide.end());
+  BalancedWavelet<> wide_wt(wide.begin(), wide.end());
+  wide_wt.cacheNodes(64);
+  EXPECT_LE(wide_wt.bitSize(), wide_plain.bitSize() + 129 * 128);
+  for (size_t i = 0; i < wide.size(); ++i) {
+    ASSERT_EQ(wide[i], wide_wt[i]) << " i = " << i;
+    ASSERT_EQ(wide_plain.rank(i, wide[i]), wide_wt.rank(i, wide[i]));
+    ASSERT_EQ(i + 1, wide_wt.select(wide_plain.rank(i + 1, wide[i]), wide[i]));
+  }
+}
+
+TEST(BalancedWaveletTest, Quantile) {
+  std::mt19937_64 mt(0);
+  vector<int> v;
+  for (int i = 0; i < 2000; ++i) {
+    v.push_back(mt() % 100);
+  }
+  BalancedWavelet<> wt(v.begin(), v.end());
+  WaveletMatrix<> wm(v.begin(), v.end());
+  for (int j = 0; j < 200; ++j) {
+    size_t l = mt() % v.size();
+    size_t r = l + 1 + mt() % (v.size() - l);
+    vector<int> sorted(v.begin() + l, v.begin() + r);
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t k = 0; k < sorted.size(); k += 1 + sorted.size() / 16) {
+      ASSERT_EQ(sorted[k], wt.quantile(l, r, k)) << l << " " << r << " " << k;
+      ASSERT_EQ(sorted[k], wm.quantile(l, r, k)) << l << " " << r << " " << k;
+    }
+    ASSERT_EQ(sorted[(sorted.size() - 1) / 2], wt.rangeMedian(l, r));
+    ASSERT_EQ(sorted[(sorted.size() - 1) / 2], wm.rangeMedian(l, r));
+  }
+}
+
+TEST(BalancedWaveletTest, TopKFrequent) {
+  std::mt19937_64 mt(0);
+  vector<int> v;
+  for (int i = 0; i < 5000; ++i) {
+    // Skewed, so that the counts are mostly distinct.
+    v.push_back((mt() % 30) * (mt() % 30));
+  }
+  BalancedWavelet<> wt(v.begin(), v.end());
+  EXPECT_TRUE(wt.topKFrequent(10, 10, 5).empty());
+  for (int j = 0; j < 100; ++j) {
+    size_t l = mt() % v.size();
+    size_t r = l + 1 + mt() % (v.size() - l);
+    size_t k = 1 + mt() % 20;
+    std::map<int, size_t> count;
+    for (size_t i = l; i < r; ++i) count[v[i]]++;
+    vector<size_t> counts;
+    for (auto& c : count) counts.push_back(c.second);
+    std::sort(counts.rbegin(), counts.rend());
+    counts.resize(std::min(k, counts.size()));
+
+    auto top = wt.topKFrequent(l, r, k);
+    ASSERT_EQ(counts.size(), top.size());
+    std::set<uint64_t> seen;
+    for (size_t i = 0; i < top.size(); ++i) {
+      ASSERT_EQ(counts[i], top[i].second) << l << " " << r << " " << i;
+      ASSERT_EQ(count[top[i].first], top[i].second);
+      ASSERT_TRUE(seen.insert(top[i].first).second);
+    }
+  }
+}
+
+TEST(BalancedWaveletTest, ForEachDistinct) {
+  std::mt19937_64 mt(0);
+  vector<int> v;
+  for (int i = 0; i < 3000; ++i) {
+    v.push_back(mt() % (i % 5 == 0 ? 500 : 40));
+  }
+  BalancedWavelet<> wt(v.begin(), v.end());
+  for (int j = 0; j < 100; ++j) {
+    size_t l1 = mt() % (v.size() + 1);
+    size_t r1 = l1 + mt() % (v.size() - l1 + 1);
+    size_t l2 = mt() % (v.size() + 1);
+    size_t r2 = l2 + mt() % (v.size() - l2 + 1);
+    std::map<uint64_t, size_t> count1, count2;
+    for (size_t i = l1; i < r1; ++i) count1[v[i]]++;
+    for (size_t i = l2; i < r2; ++i) count2[v[i]]++;
+
+    std::vector<std::pair<uint64_t, size_t>> distinct;
+    wt.forEachDistinct(l1, r1, [&](uint64_t value, size_t count) {
+      distinct.emplace_back(value, count);
+    });
+    std::vector<std::pair<uint64_t, size_t>> all(count1.begin(),
+                                                 count1.end());
+    ASSERT_EQ(all, distinct);
+
+    std::vector<std::pair<uint64_t, size_t>> expected, both;
+    for (auto& c : count1) {
+      if (count2.count(c.first)) expected.push_back(c);
+    }
+    wt.rangeIntersect(l1, r1, l2, r2,
+                      [&](uint64_t value, size_t c1, size_t c2) {
+      ASSERT_EQ(count2[value], c2);
+      both.emplace_back(value, c1);
+    });
+    ASSERT_EQ(expected, both);
+  }
+}
+
+template<typename Wt, typename Int>
+void CheckRangeNextPrev() {
+  std::mt19937_64 mt(0);
+  vector<int> v;
+  for (int i = 0; i < 3000; ++i) {
+    v.push_back(mt() % (i % 5 == 0 ? 500 : 40));
+  }
+  Wt wt(v.begin(), v.end());
+  for (int j = 0; j < 1000; ++j) {
+    size_t l = mt() % (v.size() + 1);
+    size_t r = l + mt() % std::min<size_t>(v.size() - l + 1, j % 2 ? 20 : 3000);
+    Int x = mt() % 600;
+    bool has_next = false, has_prev = false;
+    Int next = 0, prev = 0;
+    for (size_t i = l; i < r; ++i) {
+      Int x_i = v[i];
+      if (x_i >= x && (!has_next || x_i < next)) {
+        has_next = true;
+        next = x_i;
+      }
+      if (x_i <= x && (!has_prev || x_i > prev)) {
+        has_prev = true;
+        prev = x_i;
+      }
+    }
+    Int value = 0;
+    ASSERT_EQ(has_next, wt.rangeNextValue(l, r, x, &value)) << l << " " << r;
+    if (has_next) {
+      ASSERT_EQ(next, value) << l << " " << r << " " << x;
+    }
+    ASSERT_EQ(has_prev, wt.rangePrevValue(l, r, x, &value)) << l << " " << r;
+    if (has_prev) {
+      ASSERT_EQ(prev, value) << l << " " << r << " " << x;
+    }
+  }
+}
+
+TEST(WaveletTest, RangeNextPrevValue) {
+  CheckRangeNextPrev<BalancedWavelet<>, uint64_t>();
+  CheckRangeNextPrev<SkewedWavelet<>, int64_t>();
+}
+
+template<typename Wt>
+void CheckExtract() {
+  std::mt19937_64 mt(0);
+  vector<int> v;
+  while (v.size() < 3000) {
+    int value = mt() % (mt() % 4 == 0 ? 500 : 20);
+    for (int run = 1 + mt() % 5; run > 0; --run) v.push_back(value);
+  }
+  Wt wt(v.begin(), v.end());
+  vector<uint64_t> out(v.size());
+  wt.extract(0, v.size(), &out[0]);
+  ASSERT_EQ(vector<uint64_t>(v.begin(), v.end()), out);
+  // One more, to check that nothing is written past r.
+  out.push_back(0);
+  for (int j = 0; j < 200; ++j) {
+    size_t l = mt() % (v.size() + 1);
+    size_t r = l + mt() % (v.size() - l + 1);
+    std::fill(out.begin(), out.end(), -1);
+    wt.extract(l, r, &out[0]);
+    for (size_t i = l; i < r; ++i) {
+      ASSERT_EQ(v[i], out[i - l]) << l << " " << r << " " << i;
+    }
+    ASSERT_EQ(uint64_t(-1), out[r - l]);
+  }
+}
+
+TEST(WaveletTest, Extract) {
+  CheckExtract<BalancedWavelet<>>();
+  CheckExtract<RLEWavelet<BalancedWavelet<>>>();
+  CheckExtract<RLEWavelet<SkewedWavelet<>>>();
+}
+
+template<typename Wt>
+void CheckCountRange() {
+  std::mt19937_64 mt(0);
+  // Runs, so that RLEWavelet has partial runs at both ends.
+  vector<int> v;
+  while (v.size() < 3000) {
+    int value = mt() % (mt() % 4 == 0 ? 200 : 20);
+    for (int run = 1 + mt() % 5; run > 0; --run) v.push_back(value);
+  }
+  Wt wt(v.begin(), v.end());
+  for (int j = 0; j < 500; ++j) {
+    size_t l = mt() % (v.size() + 1);
+    size_t r = l + mt() % (v.size() - l + 1);
+    uint64_t lo = mt() % 250;
+    uint64_t hi = lo + mt() % (j % 2 == 0 ? 10 : 300);
+    size_t expected = 0;
+    for (size_t i = l; i < r; ++i) {
+      expected += lo <= uint64_t(v[i]) && uint64_t(v[i]) <= hi;
+    }
+    ASSERT_EQ(expected, wt.countRange(l, r, lo, hi))
+        << l << " " << r << " " << lo << " " << hi;
+  }
+}
+
+TEST(WaveletTest, CountRange) {
+  CheckCountRange<BalancedWavelet<>>();
+  CheckCountRange<SkewedWavelet<>>();
+  CheckCountRange<RLEWavelet<BalancedWavelet<>>>();
+  CheckCountRange<RLEWavelet<SkewedWavelet<>>>();
+  CheckCountRange<RLEWavelet<WaveletMatrix<>>>();
+}
+
+template<typename Wt>
+void CheckRankLEBatch() {
+  std::mt19937_64 mt(0);
+  vector<int> v;
+  for (int i = 0; i < 20000; ++i) {
+    v.push_back(i % 3 == 0 ? mt() % 5000 : mt() % 100);
+  }
+  Wt wt(v.begin(), v.end());
+  // Enough queries for several threads, some past the largest value.
+  vector<typename Wt::Query> queries(200000);
+  for (auto& q : queries) {
+    q.pos = mt() % (v.size() + 1);
+    q.value = mt() % 100 == 0 ? 10000 : mt() % 5000;
+  }
+  for (unsigned threads = 1; threads <= 4; threads += 3) {
+    vector<size_t> out(queries.size());
+    wt.rankLEBatch(&queries[0], queries.size(), &out[0], threads);
+    for (size_t i = 0; i < queries.size(); ++i) {
+      ASSERT_EQ(wt.rankLE(queries[i].pos, queries[i].value), out[i])
+          << queries[i].pos << " " << queries[i].value;
+    }
+  }
+  size_t unused = 7;
+  wt.rankLEBatch(&queries[0], 0, &unused);
+  EXPECT_EQ(7, unused);
+}
+
+TEST(WaveletTest, RankLEBatch) {
+  CheckRankLEBatch<BalancedWavelet<>>();
+  CheckRankLEBatch<SkewedWavelet<>>();
+}
+
+TEST(WaveletMatrixTest, MatchesBalanced) {
+  std::mt19937_64 mt(0);
+  vector<int> v;
+  for (int i = 0; i < 5000; ++i) {
+    v.push_back(mt() % 100);
+  }
+  BalancedWavelet<> wt(v.begin(), v.end());
+  WaveletMatrix<> wm(v.begin(), v.end());
+  ASSERT_EQ(v.size(), wm.size());
+  for (size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(v[i], wm[i]) << " i = " << i;
+  }
+  for (int j = 0; j < 1000; ++j) {
+    size_t pos = mt() % (v.size() + 1);
+    uint64_t value = mt() % 130;
+    ASSERT_EQ(wt.rank(pos, value), wm.rank(pos, value)) << pos;
+    ASSERT_EQ(wt.rankLE(pos, value), wm.rankLE(pos, value)) << pos;
+  }
+  for (int value = 0; value < 100; ++value) {
+    size_t count = wm.rank(v.size(), value);
+    for (size_t r = 1; r <= count; ++r) {
+      ASSERT_EQ(wt.select(r, value), wm.select(r, value)) << value;
+    }
+  }
+}
+
+template<unsigned Bits>
+void CheckSymbolSequence() {
+  std::mt19937_64 mt(0);
+  // Several superblocks.
+  vector<uint8_t> v;
+  for (int i = 0; i < 100000; ++i) {
+    v.push_back(mt() % (i < 50000 ? (1 << Bits) : 2));
+  }
+  SymbolSequence<Bits> seq(v);
+  ASSERT_EQ(v.size(), seq.size());
+  vector<size_t> count(1 << Bits);
+  for (size_t i = 0; i <= v.size(); ++i) {
+    if (i % 97 == 0 || i + 70 > v.size()) {
+      size_t less = 0;
+      for (unsigned c = 0; c < (1 << Bits); ++c) {
+        ASSERT_EQ(count[c], seq.rank(i, c)) << i << " " << c;
+        ASSERT_EQ(less, seq.rankLess(i, c)) << i << " " << c;
+        size_t fused_less;
+        ASSERT_EQ(count[c], seq.rankLess(i, c, &fused_less));
+        ASSERT_EQ(less, fused_less);
+        less += count[c];
+      }
+    }
+    if (i == v.size()) break;
+    ASSERT_EQ(v[i], seq[i]);
+    count[v[i]]++;
+    ASSERT_EQ(i + 1, seq.select(count[v[i]], v[i])) << i;
+  }
+}
+
+TEST(MultiaryWaveletTest, SymbolSequence) {
+  CheckSymbolSequence<2>();
+  CheckSymbolSequence<4>();
+}
+
+template<unsigned Arity>
+void CheckMultiaryMatchesBalanced() {
+  std::mt19937_64 mt(0);
+  vector<uint32_t> v;
+  for (int i = 0; i < 20000; ++i) {
+    v.push_back(mt() % (i % 5 == 0 ? 100000 : 300));
+  }
+  BalancedWavelet<> wt(v.begin(), v.end());
+  MultiaryWavelet<Arity> mw(v.begin(), v.end());
+  ASSERT_EQ(v.size(), mw.size());
+  for (size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(v[i], mw[i]) << " i = " << i;
+  }
+  for (int j = 0; j < 2000; ++j) {
+    size_t pos = mt() % (v.size() + 1);
+    uint64_t value = mt() % (j % 2 ? 300 : 140000);
+    ASSERT_EQ(wt.rank(pos, value), mw.rank(pos, value)) << pos;
+    ASSERT_EQ(wt.rankLE(pos, value), mw.rankLE(pos, value)) << pos;
+  }
+  for (int value = 0; value < 300; ++value) {
+    size_t count = mw.rank(v.size(), value);
+    for (size_t r = 1; r <= count; ++r) {
+      ASSERT_EQ(wt.select(r, value), mw.select(r, value)) << value;
+    }
+  }
+}
+
+TEST(MultiaryWaveletTest, MatchesBalanced) {
+  CheckMultiaryMatchesBalanced<4>();
+  CheckMultiaryMatchesBalanced<16>();
+}
+
+TEST(FixedWidthWaveletTest, MatchesBalanced) {
+  std::mt19937_64 mt(0);
+  vector<uint32_t> v;
+  for (int i = 0; i < 5000; ++i) {
+    v.push_back(mt() % (i % 5 == 0 ? 60000 : 300));
+  }
+  BalancedWavelet<> wt(v.begin(), v.end());
+  FixedWidthWavelet<16> fw(v.begin(), v.end());
+  ASSERT_EQ(v.size(), fw.size());
+  for (size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(v[i], fw[i]) << " i = " << i;
+  }
+  for (int j = 0; j < 2000; ++j) {
+    size_t pos = mt() % (v.size() + 1);
+    uint64_t value = mt() % (j % 2 ? 300 : 70000);
+    ASSERT_EQ(wt.rank(pos, value), fw.rank(pos, value)) << pos;
+    if (value < 65536) {
+      ASSERT_EQ(wt.rankLE(pos, value), fw.rankLE(pos, value)) << pos;
+    } else {
+      ASSERT_EQ(pos, fw.rankLE(pos, value));
+    }
+  }
+  for (int value = 0; value < 300; ++value) {
+    size_t count = fw.rank(v.size(), value);
+    for (size_t r = 1; r <= count; ++r) {
+      ASSERT_EQ(wt.select(r, value), fw.select(r, value)) << value;
+    }
+  }
+}
+
+TEST(FixedWidthWaveletTest, RejectsWideValues) {
+  vector<uint32_t> v = {1, 255, 256, 3};
+  EXPECT_THROW(FixedWidthWavelet<8>(v.begin(), v.end()),
+               std::invalid_argument);
+  vector<int> neg = {1, -1};
+  EXPECT_THROW(FixedWidthWavelet<8>(neg.begin(), neg.end()),
+               std::invalid_argument);
+  v.pop_back();
+  v.pop_back();
+  EXPECT_EQ(2u, FixedWidthWavelet<8>(v.begin(), v.end()).size());
+}
+
+template<typename BitVector>
+void CheckHuffmanMatchesBalanced() {
+  std::mt19937_64 mt(0);
+  // Zipfian.
+  vector<uint64_t> v;
+  for (int i = 0; i < 20000; ++i) {
+    v.push_back(1000000 / (1 + mt() % 1000));
+  }
+  BalancedWavelet<> wt(v.begin(), v.end());
+  HuffmanWavelet<BitVector> hw(v.begin(), v.end());
+  ASSERT_EQ(v.size(), hw.size());
+  EXPECT_LT(hw.bitSize(), wt.bitSize());
+  for (size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(v[i], hw[i]) << " i = " << i;
+  }
+  for (int j = 0; j < 2000; ++j) {
+    size_t pos = mt() % (v.size() + 1);
+    uint64_t value = j % 2 ? v[mt() % v.size()] : mt() % 1000001;
+    ASSERT_EQ(wt.rank(pos, value), hw.rank(pos, value)) << pos;
+  }
+  for (int j = 0; j < 100; ++j) {
+    uint64_t value = v[mt() % v.size()];
+    size_t count = hw.rank(v.size(), value);
+    for (size_t r = 1; r <= count; ++r) {
+      ASSERT_EQ(wt.select(r, value), hw.select(r, value)) << value;
+    }
+  }
+}
+
+TEST(HuffmanWaveletTest, MatchesBalanced) {
+  CheckHuffmanMatchesBalanced<FastBitVector>();
+  CheckHuffmanMatchesBalanced<RRRBitVector>();
+}
+
+TEST(HuffmanWaveletTest, Small) {
+  vector<int> one = {7, 7, 7};
+  HuffmanWavelet<> a(one.begin(), one.end());
+  EXPECT_EQ(7, a[1]);
+  EXPECT_EQ(2, a.rank(2, 7));
+  EXPECT_EQ(0, a.rank(2, 6));
+  EXPECT_EQ(3, a.select(3, 7));
+  vector<int> v = {4,2,3,1,2,3,4,5,0,2,2,2};
+  HuffmanWavelet<> b(v.begin(), v.end());
+  for (size_t i = 0; i < v.size(); ++i) {
+    EXPECT_EQ(v[i], b[i]) << " i = " << i;
+  }
+  EXPECT_EQ(5, b.rank(v.size(), 2));
+  EXPECT_EQ(10, b.select(3, 2));
+  HuffmanWavelet<> empty(v.begin(), v.begin());
+  EXPECT_EQ(0, empty.size());
+  EXPECT_EQ(0, empty.rank(0, 2));
+}
+
+TEST(DynamicWaveletTest, Updates) {
+  std::mt19937_64 mt(0);
+  vector<uint64_t> v;
+  for (int i = 0; i < 3000; ++i) {
+    v.push_back(mt() % 200);
+  }
+  DynamicWavelet<> dw(v.begin(), v.end(), 10);
+  ASSERT_EQ(10, dw.bits());
+  for (int round = 0; round < 10; ++round) {
+    for (int j = 0; j < 3000; ++j) {
+      size_t pos = mt() % (v.size() + 1);
+      uint64_t value = mt() % (j % 4 ? 200 : 1024);
+      int op = mt() % 3;
+      if (v.empty() || op == 0 || (round < 5 && op == 1)) {
+        dw.insert(pos, value);
+        v.insert(v.begin() + pos, value);
+      } else if (op == 1) {
+        pos = std::min(pos, v.size() - 1);
+        ASSERT_EQ(v[pos], dw.erase(pos)) << pos;
+        v.erase(v.begin() + pos);
+      } else {
+        pos = std::min(pos, v.size() - 1);
+        dw.set(pos, value);
+        v[pos] = value;
+      }
+    }
+    ASSERT_EQ(v.size(), dw.size());
+    for (size_t i = 0; i < v.size(); ++i) {
+      ASSERT_EQ(v[i], dw[i]) << " i = " << i;
+    }
+    BalancedWavelet<> wt(v.begin(), v.end());
+    for (int j = 0; j < 500; ++j) {
+      size_t pos = mt() % (v.size() + 1);
+      uint64_t value = mt() % 1024;
+      ASSERT_EQ(wt.rank(pos, value), dw.rank(pos, value)) << pos;
+      ASSERT_EQ(wt.rankLE(pos, value), dw.rankLE(pos, value)) << pos;
+    }
+    for (int j = 0; j < 20; ++j) {
+      uint64_t value = v[mt() % v.size()];
+      size_t count = dw.rank(v.size(), value);
+      for (size_t r = 1; r <= count; ++r) {
+        ASSERT_EQ(wt.select(r, value), dw.select(r, value)) << value;
+      }
+    }
+  }
+  DynamicWavelet<> empty(4);
+  EXPECT_EQ(0, empty.rank(0, 3));
+  empty.insert(0, 15);
+  empty.insert(0, 3);
+  EXPECT_EQ(15, empty[1]);
+  EXPECT_EQ(1, empty.select(1, 3));
+  EXPECT_EQ(2, empty.rankLE(2, 15));
+}
+
 template<typename T>
 class WaveletTest : public ::testing::Test {
 
@@ -39,10 +657,22 @@ typedef ::testing::Types<
   SkewedWavelet<>,
   RLEWavelet<BalancedWavelet<>>,
   RLEWavelet<SkewedWavelet<>>,
+  WaveletMatrix<>,
+  RLEWavelet<WaveletMatrix<>>,
+  BalancedWavelet<InterleavedBitVector>,
+  BalancedWavelet<DenseSelectBitVector>,
+  BalancedWavelet<BasicFastBitVector<FineSampling>>,
   BalancedWavelet<RRRBitVector>,
   SkewedWavelet<RRRBitVector>,
   RLEWavelet<BalancedWavelet<RRRBitVector>>,
-  RLEWavelet<SkewedWavelet<RRRBitVector>>
+  RLEWavelet<SkewedWavelet<RRRBitVector>>,
+  WaveletMatrix<RRRBitVector>,
+  MultiaryWavelet<4>,
+  MultiaryWavelet<16>,
+  FixedWidthWavelet<8>,
+  FixedWidthWavelet<32>,
+  FixedWidthWavelet<64, RRRBitVector>,
+  DynamicWavelet<>
   > WaveletTypes;
 
 TYPED_TEST_CASE(WaveletTest, WaveletTypes );